@@ -9,6 +9,14 @@
 //
 extern iopbase_t iop_create(void);
 
+//
+// iop_create_ex - 创建新的 iopbase_t 对象, 指定最大 io 数量和特性
+// maxio    : 最大并发 io 数量, 0 表示默认 INT_IOP, 最大 IOP_IDMASK. ios 会按块逐步扩容到 maxio
+// flags    : 特性标识 IOP_F_XXX, 构建后以 base->flags 为准
+// return   : 失败返回 NULL
+//
+extern iopbase_t iop_create_ex(uint32_t maxio, uint32_t flags);
+
 //
 // iop_delete - 销毁 iopbase_t 对象
 // base     : 待销毁的 io 调度对象
@@ -23,15 +31,25 @@ extern void iop_delete(iopbase_t base);
 //
 extern int iop_dispatch(iopbase_t base);
 
+//
+// iop_now_ms - 得到本轮调度缓存的单调时钟毫秒数, 回调中使用不会再读系统时钟
+// base     : io 调度对象
+// return   : 毫秒数
+//
+inline uint64_t iop_now_ms(iopbase_t base) {
+    return base->curt;
+}
+
 //
 // iop_add - 添加一个新的事件对象到 iopbase 调度对象集中
 // base     : io 调度对象
 // s        : socket 处理句柄
 // event   : 处理事件类型 EV_XXX
-// to       : 超时时间, '-1' 表示永不超时
+// to       : 超时毫秒数, '-1' 表示永不超时
 // fevent   : 事件回调函数
 // arg      : 用户参数
-// return   : 成功返回 iop 的 id, 失败返回 EBase
+// return   : 成功返回 iop 的 id, 失败返回 EBase, 此时 s 仍由调用方负责关闭
+//            id 带有代数, iop_del 之后旧 id 再用于 iop_send/iop_mod/iop_del 都会返回 EParam
 //
 extern uint32_t iop_add(iopbase_t base, 
     socket_t s, uint32_t events, uint32_t to, iop_event_f fevent, void * arg);
@@ -40,7 +58,7 @@ extern uint32_t iop_add(iopbase_t base,
 // iop_del - iop 销毁事件
 // base     : io 调度对象
 // id       : iop 事件 id
-// return   : >=0 成功, <0 表示失败
+// return   : >=0 成功, <0 表示失败, id 已经失效返回 EParam
 //
 extern int iop_del(iopbase_t base, uint32_t id);
 
@@ -49,12 +67,152 @@ extern int iop_del(iopbase_t base, uint32_t id);
 // base     : io事件集基础对象 
 // id       : iop事件id
 // event   : 新的 event 事件
-// return   : >= SBase 成功. 否则 表示失败
+// return   : >= SBase 成功. 否则 表示失败, id 已经失效返回 EParam
 //
 extern int iop_mod(iopbase_t base, uint32_t id, uint32_t events);
 
+//
+// iop_connect - 发起非阻塞连接, 结果通过 fevent 通知, 调用线程不等待
+// base     : io 调度对象
+// host     : ip:port 串, 域名解析仍然是同步的
+// to       : 超时毫秒数, 连接中超时回调 EV_ERROR, 连上后就是普通的 iop 超时, '-1' 表示永不超时
+// fevent   : 事件回调函数, 连上时回调 EV_CONNECT, 此后关注 EV_READ; 失败回调 EV_ERROR 后删除
+// arg      : 用户参数
+// return   : 成功返回 iop 的 id, 连接结果还没出来; 失败返回 EBase
+//
+extern uint32_t iop_connect(iopbase_t base, const char * host, uint32_t to, iop_event_f fevent, void * arg);
+
+//
+// iop_timeout - 修改 iop 超时时间, 从现在开始重新计时
+// base     : io 调度对象
+// id       : iop 对象的 id
+// to       : 超时毫秒数, '-1' 表示永不超时
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+extern int iop_timeout(iopbase_t base, uint32_t id, uint32_t to);
+
+//
+// iop_pause_read - 暂停读, 从后端去掉 EV_READ, ruf 中已经收到的数据保留
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+extern int iop_pause_read(iopbase_t base, uint32_t id);
+
+//
+// iop_resume_read - 恢复读, 和 iop_pause_read 成对调用, 计数归零时才重新关注 EV_READ, 暂停前就不读的保持不读
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+extern int iop_resume_read(iopbase_t base, uint32_t id);
+
+//
+// iop_ready - iop 挂到就绪链表, 下一轮 poll 之前回调 EV_READY, 这一轮不会阻塞等待
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+extern int iop_ready(iopbase_t base, uint32_t id);
+
+//
+// iop_post - 投递消息到 base 的调度线程执行, 任意线程都可以调用
+// base     : io 调度对象
+// post     : 待投递消息, fpost 需要提前设置
+// return   : void
+//
+extern void iop_post(iopbase_t base, struct ioppost * post);
+
+//
+// iop_post_send - 跨线程发送数据, 数据复制后投递给调度线程去 iop_send, 任意线程都可以调用
+// base     : io 调度对象
+// id       : iop 对象的 id
+// data     : 待发送数据
+// len      : 数据长度
+// return   : >= SBase 表示投递成功, 连接在发送前已经关闭时数据直接丢弃
+//
+extern int iop_post_send(iopbase_t base, uint32_t id, const void * data, uint32_t len);
+
 // iop_xxxx 轮询事件的发送接收操作, 发送没变化, 接收放在接收缓冲区
+// 队列越过高水位时先回调 EV_WHIGH, 回调返回 < SBase 时 iop_send 原样返回, 数据已经进队列
 extern int iop_send(iopbase_t base, uint32_t id, const void * data, uint32_t len);
+
+//
+// iop_watermark - 设置发送队列高低水位, 默认 INT_SEND 和 INT_SENDLOW
+// base     : io 调度对象
+// id       : iop 对象的 id
+// high     : 高水位, 队列长度越过时回调 EV_WHIGH
+// low      : 低水位, EV_WHIGH 之后回落到不超过它时回调 EV_WLOW, 要小于 high
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+extern int iop_watermark(iopbase_t base, uint32_t id, uint32_t high, uint32_t low);
+
+//
+// iop_buf_create - 创建引用计数为 1 的只读缓冲区
+// data     : 待复制的数据, NULL 时只分配, 由调用方填充 buf->data
+// len      : 数据长度
+// return   : 失败返回 NULL
+//
+extern iop_buf_t iop_buf_create(const void * data, uint32_t len);
+
+//
+// iop_buf_delete - 释放一个引用, 计数到 0 时释放内存, 任意线程都可以调用
+// buf      : iop_buf_create 返回的对象
+// return   : void
+//
+extern void iop_buf_delete(iop_buf_t buf);
+
+//
+// iop_send_buf - 把 buf 挂到连接的发送队列上, 不复制数据, 成功时队列持有一个引用
+// base     : io 调度对象
+// id       : iop 对象的 id
+// buf      : 待发送的缓冲区, 调用方的引用不变
+// return   : >= SBase 成功, 和 iop_send 一致
+//
+extern int iop_send_buf(iopbase_t base, uint32_t id, iop_buf_t buf);
+
+//
+// iop_broadcast - 同一份 buf 发给多个连接, 每个连接只增加引用不复制
+// base     : io 调度对象
+// ids      : iop id 数组, 已经失效的跳过
+// n        : ids 长度
+// buf      : 待发送的缓冲区, 调用方的引用不变, 发完后可以直接 iop_buf_delete
+// return   : 成功挂上的连接数
+//
+extern uint32_t iop_broadcast(iopbase_t base, const uint32_t * ids, uint32_t n, iop_buf_t buf);
+
+//
+// iop_sendv - 把 iop->suf 中积压的多段数据一次 writev 尽量发出去, 发出的部分从队列弹出
+// iop      : iop 对象
+// return   : >= SBase 发送的字节数, < SBase 出错, 原因看 errno
+//
+extern int iop_sendv(iop_t iop);
+
+//
+// iop_recv - 读取一次数据, IOP_F_RSHARE 且 ruf 为空时留在共用缓冲区, 否则追加到 iop->ruf 中
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : > SBase 读到的字节数, SBase 暂时没有数据, EClose 对端关闭, 其它 < SBase 错误
+//
 extern int iop_recv(iopbase_t base, uint32_t id);
 
+//
+// iop_rbuf - 得到 iop 待解析的接收数据, 可能是 iop->ruf 也可能是共用的 base->rbuf
+// base     : io 调度对象
+// iop      : iop 对象
+// return   : 待解析数据, 解析完后用 iop_rpop 弹出
+//
+inline tbuf_t iop_rbuf(iopbase_t base, iop_t iop) {
+    return tbuf_len(base->rbuf) > 0 && base->rid == iop->id ? base->rbuf : iop->ruf;
+}
+
+//
+// iop_rpop - 弹出 iop_rbuf 头部已经处理的数据, 共用缓冲区剩下的尾包按实际大小搬进 iop->ruf
+// base     : io 调度对象
+// iop      : iop 对象
+// len      : 已经处理的长度
+// return   : void
+//
+extern void iop_rpop(iopbase_t base, iop_t iop, size_t len);
+
 #endif//_H_IOP_LIBIOP
@@ -2,6 +2,9 @@
 #define _H_IOP_DEF_LIBIOP
 
 #include "tstr.h"
+#include "tbuf.h"
+#include "mpsc.h"
+#include "twheel.h"
 #include "socket.h"
 
 //
@@ -10,6 +13,14 @@
 #define IOP_FREE        (0)         // 释放操作
 #define IOP_IO          (1)         // IO操作
 
+//
+// IOP_IDXXX 是 iop id 的组成, 低 20 位是 ios 下标, 其上 11 位是代数, 最高位恒为 0
+// iop_del 后代数加一, 持有旧 id 的异步发送者不会误操作复用该下标的新连接
+//
+#define IOP_IDBIT       (20)
+#define IOP_IDMASK      ((1u << IOP_IDBIT) - 1)
+#define IOP_IDGEN       (0x7ffu << IOP_IDBIT)
+
 //
 // EV_XXX 是特定消息处理动作的标识
 //
@@ -18,18 +29,44 @@
 #define EV_CREATE       (1 << 2)    // 创建事件
 #define EV_DELETE       (1 << 3)    // 销毁事件
 #define EV_TIMEOUT      (1 << 4)    // 超时事件
+#define EV_RECV         (1 << 5)    // 完成模式收发, 只对 IOP_F_UIO 有效, 数据由后端收进 ruf, 回调只见 EV_READ
+#define EV_WHIGH        (1 << 6)    // 发送队列涨过高水位, 只在回调中出现, 用来暂停读或者生产
+#define EV_WLOW         (1 << 7)    // 发送队列回落到低水位, 只在 EV_WHIGH 之后出现一次
+#define EV_READY        (1 << 8)    // iop_ready 挂上的就绪回调, 下一轮 poll 之前触发
+#define EV_NBLOCK       (1 << 9)    // 只用于 iop_add, s 已经是非阻塞, 省掉一次 fcntl
+#define EV_CONNECT      (1 << 10)   // iop_connect 连接建立成功
+#define EV_ERROR        (1 << 11)   // iop_connect 连接失败或者超时, 原因看 errno, 回调后 iop 被删除
+
+//
+// IOP_F_XXX 是 iop_create_ex 构建 iopbase 时的特性标识
+//
+#define IOP_F_ET        (1 << 0)    // epoll 边缘触发, 读写都要做到 EAGAIN, 不支持的模型会清掉
+#define IOP_F_URING     (1 << 1)    // 优先 io_uring 轮询, 内核不支持时回退 epoll 并清掉, 开启后带上 IOP_F_ET
+#define IOP_F_UIO       (1 << 2)    // io_uring 完成模式收发, 依赖 IOP_F_URING, 不支持时清掉
+#define IOP_F_RSHARE    (1 << 3)    // 共用 iopbase 的接收缓冲区原地解析, ruf 只存不完整的尾包
+#define IOP_F_CORK      (1 << 4)    // iop_send 只进发送队列, 每轮调度结束时脏连接统一 writev
 
 //
 // INT_XXX 系统运行中用到的参数
 //
-#define INT_DISPATCH   (500)       // 事件调度的时间间隔 毫秒
-#define INT_KEEPALIVE  (60)        // 心跳包检查 秒
-#define INT_IOP        (1024)      // 支持的 IO 链接最大数量
-#define INT_SEND       (1 << 22)   // socket send buf 最大 4M
+#define INT_DISPATCH   (500)       // 事件调度的最大时间间隔 毫秒
+#define INT_URING      (1024)      // io_uring 提交队列长度
+#define INT_URBUF      (256)       // io_uring 接收缓冲池块数, 必须是 2 的幂
+#define INT_URBUFSZ    (1 << 14)   // io_uring 接收缓冲池每块 16k
+#define INT_IOP        (1024)      // 支持的 IO 链接最大数量, 最大不超过 IOP_IDMASK
+#define INT_IOPBIT     (8)         // ios 分块扩容, 每块 1 << 8 个 iop
+#define INT_SEND       (1 << 22)   // 发送队列默认高水位 4M
+#define INT_SENDLOW    (1 << 20)   // 发送队列默认低水位 1M
+#define INT_SEG        (1 << 12)   // 发送队列新段的最小容量, 小数据拼进尾段
+#define INT_IOV        (64)        // 一次 writev 最多聚合的段数
+#define INT_IDS        (64)        // dirty 和 ready 等 id 表的初始容量
+#define INT_ACCEPT     (64)        // 监听每次可读最多 accept 的连接数
+#define INT_ACCEPTBK   (1000)      // accept 出错 (EMFILE ENFILE ...) 时退避的最长毫秒数, 从 10 毫秒起翻倍
 #define INT_RECV       (1 << 16)   // 32k 接收缓冲区
 
 typedef struct iop * iop_t;
 typedef struct iopbase * iopbase_t;
+typedef struct iopbuf * iop_buf_t;
 
 // 调度处理事件
 typedef int (* iop_dispatch_f)(iopbase_t base, uint32_t id);
@@ -42,6 +79,25 @@ typedef int (* iop_dispatch_f)(iopbase_t base, uint32_t id);
 //
 typedef int (* iop_parse_f)(const char * buf, uint32_t len);
 
+//
+// iopcur - 连接的解析游标, 解析出一个包后由调度方清零
+//
+struct iopcur {
+    uint32_t need;            // 待解析数据至少到这么长才再调用解析器, 0 表示有数据就调用
+    uint32_t off;             // 已经扫描过的长度, 下次从这里接着找
+    uint64_t state;           // 解析器自己的状态
+    uint64_t body;            // 返回 > 0 时可以设置, 包后面紧跟的流式 body 字节数, 不进 ruf 而是分块交给 fchunk
+};
+
+//
+// iop_parsex_f - 带游标的协议解析回调函数, 不够一个包时填好 cur, 避免每次从头扫描
+// buf      : 数据内存首地址, 总是从当前包开头算起
+// len      : 处理数据长度
+// cur      : 连接的解析游标
+// return   : 0 表示需要继续解析, -1 协议错误, >0 解析好一个包
+//
+typedef int (* iop_parsex_f)(const char * buf, uint32_t len, struct iopcur * cur);
+
 //
 // iop_f - 基础事件的回调函数
 // base     : iopbase 结构指针, iop 基础对象集
@@ -71,6 +127,58 @@ typedef int (* iop_event_f)(iopbase_t base, uint32_t id, uint32_t events, void *
 //
 typedef int (* iop_processor_f)(iopbase_t base, uint32_t id, char * buf, uint32_t len, void * arg);
 
+//
+// iop_chunk_f - 流式 body 处理器, body 按到达顺序分块回调, 数据只在回调中有效
+// base     : iopbase 结构指针, iop基础对象集
+// id       : iop对象的id
+// buf      : 本块数据起始点
+// len      : 本块数据长度
+// left     : 本块之后 body 还剩的字节数, 0 表示 body 结束
+// arg      : 自带的参数
+// return   : -1 代表要关闭连接, 0 代表正常
+//
+typedef int (* iop_chunk_f)(iopbase_t base, uint32_t id, const char * buf, uint32_t len, uint64_t left, void * arg);
+
+//
+// ioppost - 跨线程投递给调度线程的消息, 可以内嵌在更大结构的头部
+// fpost 在调度线程中执行, 并负责释放 post 内存
+//
+struct ioppost {
+    struct mpscnode node;
+    void (* fpost)(iopbase_t base, struct ioppost * post);
+};
+
+//
+// iopbuf - 引用计数的只读缓冲区, 可以同时挂在多个连接的发送队列上, 计数原子操作可以跨线程
+//
+struct iopbuf {
+    uint32_t ref;             // 引用计数, 最后一个连接发完时释放
+    uint32_t len;             // 数据长度
+    char data[];
+};
+
+//
+// iopseg - 发送队列中的一段数据, [head, tail) 待发送
+// buf 不为 NULL 时数据在 buf->data 中, 只引用不复制, 也不再往里拼接
+//
+struct iopseg {
+    struct iopseg * next;
+    struct iopbuf * buf;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t cap;
+    char data[];
+};
+
+//
+// iopsq - 发送队列, 多段数据一次 writev 发出去, 发完的段整段释放不搬移
+//
+struct iopsq {
+    struct iopseg * head;
+    struct iopseg * tail;
+    size_t len;               // 待发送总长度
+};
+
 //
 // iop结构, 每一个iop对象都会对应一个iop结构
 //
@@ -82,15 +190,29 @@ struct iop {
     socket_t s;               // 对应的socket
     uint16_t type;            // 对象类型 IOP_XXX 0:free, 1:io
     uint32_t event;           // 关注的事件
-    uint32_t timeout;         // 超时值
+    uint32_t timeout;         // 超时毫秒值
 
     iop_event_f fevent;       // 事件毁掉函数
     void * arg;               // 用户指定参数, 由用户负责释放资源
     void * srg;               // 系统指定参数, 由系统自动释放资源
 
-    struct tstr suf[1];       // 发送缓冲区, 希望保存在栈上
-    struct tstr ruf[1];       // 接收缓冲区
-    time_t last;              // 最后一次调度时间
+    struct iopsq suf[1];      // 发送队列, 希望保存在栈上
+    struct tbuf ruf[1];       // 接收缓冲区
+    int rn;                   // 完成模式下已收进 ruf 还没被 iop_recv 取走的字节数, 或者 EClose / EBase
+    void * sending;           // 完成模式下在路上的发送, 删除时要取消, NULL 表示没有
+    size_t sflight;           // 完成模式下已经交给内核还没发完的字节数, 和 suf 一起算水位
+    bool rstop;               // 完成模式下发送积压, 暂停了接收
+    bool dirty;               // IOP_F_CORK 下已经挂在 base->dirty 上等待本轮刷出
+    bool ready;               // 已经挂在 base->ready 上等待下一轮回调 EV_READY
+    bool wfull;               // 发送队列越过高水位, 还没回落到低水位
+    uint16_t rpause;          // iop_pause_read 计数, 不为 0 时不关注 EV_READ
+    bool rhold;               // 暂停扣下了 EV_READ, 计数归零时才加回来
+    uint32_t whigh;           // 发送队列高水位, 越过时回调 EV_WHIGH
+    uint32_t wlow;            // 发送队列低水位, 回落时回调 EV_WLOW
+    struct iopcur cur[1];     // 解析游标, iops 使用 fparsex 时记录当前包的解析进度
+    uint64_t rbody;           // 流式 body 还没交给 fchunk 的字节数
+    uint64_t last;            // 最后一次调度时间, 毫秒
+    struct tnode timer;       // 超时节点, 挂在 base->wheel 上
 };
 
 struct iopop {
@@ -99,26 +221,89 @@ struct iopop {
     int  (* fdel)(iopbase_t, uint32_t, socket_t);           // 删除事件接口
     int  (* fadd)(iopbase_t, uint32_t, socket_t, uint32_t); // 添加事件接口
     int  (* fmod)(iopbase_t, uint32_t, socket_t, uint32_t); // 修改事件接口
+    int  (* fsend)(iopbase_t, iop_t);                       // 完成模式发送 suf 接口, 可以为 NULL
 };
 
 struct iopbase {
     int dispatch;            // 调度的事件间隔
+    uint32_t flags;          // 特性标识 IOP_F_XXX
     struct iopop op;         // 事件模型的内部实现
     void * mata;             // 事件模型特定数据
 
-    time_t curt;             // 当前调度时间
-    time_t last;             // 上次调度时间
-    time_t keepalive;        // 最后一次心跳的时间
+    uint64_t curt;           // 当前调度时间, 单调时钟毫秒, 每轮调度只读一次
+    struct twheel wheel;     // iop 超时时间轮, 刻度是 curt 毫秒
 
     iop_dispatch_f fdel;     // iop 移除操作
 
+    struct mpsc posts;       // 跨线程投递队列, 每轮调度开始时处理
+    uint32_t wake;           // 1 表示已经唤醒过, 等待调度线程处理
+    socket_t wfd;            // eventfd 唤醒句柄
+
+    struct tbuf rbuf[1];     // IOP_F_RSHARE 共用的接收缓冲区, INT_RECV 大小
+    uint32_t rid;            // rbuf 中数据所属的 iop id
+
+    uint32_t * dirty;        // IOP_F_CORK 本轮有待发送数据的 iop id
+    uint32_t ndirty;         // dirty 中 id 个数
+    uint32_t cdirty;         // dirty 容量
+
+    uint32_t * ready;        // iop_ready 挂上的 iop id, 下一轮 poll 之前回调
+    uint32_t nready;         // ready 中 id 个数
+    uint32_t cready;         // ready 容量
+
     uint32_t maxio;          // 最大并发数 io
+    uint32_t capio;          // 已分配 iop 数量, 按块增长
     uint32_t iohead;         // 已用 iop 列表
     uint32_t freehead;       // 可用 iop 列表头
     uint32_t freetail;       // 可用 iop 列表尾
-    struct iop ios[];        // 所有 iop 对象
+    struct iop ** ios;       // iop 分块表, 扩容不移动已有 iop
 };
 
+//
+// iopsq_push - 数据追加到发送队列尾, 尾段放得下就拼进去, 否则新开一段
+// iopsq_pushb - 引用 buf 中 off 之后的数据追加成一段, 不复制
+// iopsq_iov - 从队列头填充最多 n 个 iovec, 返回填充个数
+// iopsq_pop - 弹出已经发送的 len 字节, 发完的段直接释放
+// iopsq_clear - 释放队列中所有段
+//
+extern int iopsq_push(struct iopsq * sq, const void * data, uint32_t len);
+extern int iopsq_pushb(struct iopsq * sq, iop_buf_t buf, uint32_t off);
+extern int iopsq_iov(struct iopsq * sq, struct iovec * iov, int n);
+extern void iopsq_pop(struct iopsq * sq, size_t len);
+extern void iopsq_clear(struct iopsq * sq);
+
+//
+// iop_wlow - 发送后检查队列是否回落到低水位, 是就回调 EV_WLOW
+// base     : io 调度对象
+// iop      : iop 对象
+// return   : 回调的返回值, < SBase 表示调用方需要删除 iop
+//
+extern int iop_wlow(iopbase_t base, iop_t iop);
+
+//
+// iop_get - 通过 id 得到 iop 对象, 不校验代数
+// base     : iop 对象集(管理器)
+// id       : iop 对象的 id, 下标需要 < base->capio
+// return   : iop 对象
+//
+inline iop_t iop_get(iopbase_t base, uint32_t id) {
+    id &= IOP_IDMASK;
+    return base->ios[id >> INT_IOPBIT] + (id & ((1 << INT_IOPBIT) - 1));
+}
+
+//
+// iop_find - 通过 id 找到存活的 iop 对象, 会校验下标和代数
+// base     : iop 对象集(管理器)
+// id       : iop 对象的 id
+// return   : id 已经失效返回 NULL
+//
+inline iop_t iop_find(iopbase_t base, uint32_t id) {
+    iop_t iop;
+    if ((id & IOP_IDMASK) >= base->capio)
+        return NULL;
+    iop = iop_get(base, id);
+    return iop->id == id && iop->type != IOP_FREE ? iop : NULL;
+}
+
 //
 // iop_callback - iop 处理帮助函数
 // base     : iop 对象集(管理器), 所有 iop 对象起点基础
@@ -0,0 +1,74 @@
+﻿#ifndef _H_IOP_PARSE_LIBIOP
+#define _H_IOP_PARSE_LIBIOP
+
+#include "iop_def.h"
+
+//
+// 内置 iop_parse_f 分帧器, 直接传给 iops_create. 返回值和 iop_parse_f 一致:
+// 0 还不够一帧, EParse 协议错误, > 0 整帧长度, 包含长度前缀或者分隔符
+// 一帧超过 INT_RECV 时接收缓冲区永远放不下, 直接按 EParse 处理
+// iop_parsex_xxx 是带游标的版本, 传给 iopsopt::fparsex, 数据不够时记下还差多少和扫到哪里
+//
+
+// iop_parse_be16   - 2 字节大端长度前缀, 长度只算 body
+// iop_parse_be32   - 4 字节大端长度前缀, 长度只算 body
+// iop_parse_le16   - 2 字节小端长度前缀, 长度只算 body
+// iop_parse_le32   - 4 字节小端长度前缀, 长度只算 body
+// iop_parse_varint - varint (LEB128) 长度前缀, 最多 5 字节, 长度只算 body
+extern int iop_parse_be16(const char * buf, uint32_t len);
+extern int iop_parse_be32(const char * buf, uint32_t len);
+extern int iop_parse_le16(const char * buf, uint32_t len);
+extern int iop_parse_le32(const char * buf, uint32_t len);
+extern int iop_parse_varint(const char * buf, uint32_t len);
+
+extern int iop_parsex_be16(const char * buf, uint32_t len, struct iopcur * cur);
+extern int iop_parsex_be32(const char * buf, uint32_t len, struct iopcur * cur);
+extern int iop_parsex_le16(const char * buf, uint32_t len, struct iopcur * cur);
+extern int iop_parsex_le32(const char * buf, uint32_t len, struct iopcur * cur);
+extern int iop_parsex_varint(const char * buf, uint32_t len, struct iopcur * cur);
+
+// iop_parse_lf     - 以 '\n' 结尾的行
+// iop_parse_crlf   - 以 "\r\n" 结尾的行
+// iop_parse_nul    - 以 '\0' 结尾的串
+// iop_parse_head   - 以 "\r\n\r\n" 结尾的 http 风格头部
+extern int iop_parse_lf(const char * buf, uint32_t len);
+extern int iop_parse_crlf(const char * buf, uint32_t len);
+extern int iop_parse_nul(const char * buf, uint32_t len);
+extern int iop_parse_head(const char * buf, uint32_t len);
+
+extern int iop_parsex_lf(const char * buf, uint32_t len, struct iopcur * cur);
+extern int iop_parsex_crlf(const char * buf, uint32_t len, struct iopcur * cur);
+extern int iop_parsex_nul(const char * buf, uint32_t len, struct iopcur * cur);
+extern int iop_parsex_head(const char * buf, uint32_t len, struct iopcur * cur);
+
+//
+// iop_parse_delim - 按任意分隔符分帧, 自定义分隔符时包一层成 iop_parse_f
+// buf      : 待解析数据
+// len      : 数据长度
+// delim    : 分隔符
+// dlen     : 分隔符长度, 大于 0
+// return   : 和 iop_parse_f 一致, > 0 时包含分隔符
+//
+extern int iop_parse_delim(const char * buf, uint32_t len, const char * delim, uint32_t dlen);
+
+//
+// iop_parsex_delim - 按任意分隔符分帧, 没找到时记下扫描位置, 下次只扫新到的数据
+// buf      : 待解析数据
+// len      : 数据长度
+// delim    : 分隔符
+// dlen     : 分隔符长度, 大于 0
+// cur      : 解析游标
+// return   : 和 iop_parse_f 一致, > 0 时包含分隔符
+//
+extern int iop_parsex_delim(const char * buf, uint32_t len, const char * delim, uint32_t dlen, struct iopcur * cur);
+
+//
+// iop_memchr - 查找字节 c 第一次出现的位置, 有 SSE2/AVX2 时每次比较 16/32 字节
+// buf      : 待查找数据
+// len      : 数据长度
+// c        : 待查找的字节
+// return   : 找到返回位置, 否则返回 NULL
+//
+extern const char * iop_memchr(const char * buf, uint32_t len, int c);
+
+#endif//_H_IOP_PARSE_LIBIOP
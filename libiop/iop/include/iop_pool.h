@@ -0,0 +1,46 @@
+﻿#ifndef _H_IOP_POOL_LIBIOP
+#define _H_IOP_POOL_LIBIOP
+
+#include "iop.h"
+
+// iopp 单个 iopbase 内的出站连接池, 只能在该 iopbase 的调度线程中使用
+typedef struct iopp * iopp_t;
+
+//
+// iopp_create - 创建连接池, 连接都挂在 base 上, 要在 iop_delete(base) 之前 iopp_delete
+// base     : io 调度对象
+// maxidle  : 每个 host 最多保留的空闲连接数
+// idle     : 空闲连接保留毫秒数, 超时关闭, '-1' 表示一直保留
+// to       : 连接和取出后使用中的超时毫秒数, '-1' 表示永不超时
+// return   : 失败返回 NULL
+//
+extern iopp_t iopp_create(iopbase_t base, uint32_t maxidle, uint32_t idle, uint32_t to);
+
+//
+// iopp_delete - 关闭所有空闲连接并释放连接池, 已经取出的连接不受影响
+// p        : iopp_create 返回的对象
+// return   : void
+//
+extern void iopp_delete(iopp_t p);
+
+//
+// iopp_get - 取出一个到 host 的连接, 没有空闲的就 iop_connect 新建
+// 有空闲连接时在返回前就回调 EV_CONNECT, 新建的连上后回调 EV_CONNECT, 失败回调 EV_ERROR
+// p        : 连接池
+// host     : ip:port 串
+// fevent   : 使用中的事件回调
+// arg      : 用户参数
+// return   : 成功返回 iop 的 id, 失败返回 EBase
+//
+extern uint32_t iopp_get(iopp_t p, const char * host, iop_event_f fevent, void * arg);
+
+//
+// iopp_put - 用完的连接还回连接池, 还有未发完或者未处理的数据, 或者空闲数已满时直接关闭
+// 还回后 fevent 不再收到任何事件, 包括 EV_DELETE, arg 可以直接释放
+// p        : 连接池
+// id       : iopp_get 得到的 iop id
+// return   : >= SBase 成功, 连接直接关闭时也返回 SBase, id 不是池中连接返回 EParam
+//
+extern int iopp_put(iopp_t p, uint32_t id);
+
+#endif//_H_IOP_POOL_LIBIOP
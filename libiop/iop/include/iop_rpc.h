@@ -0,0 +1,54 @@
+﻿#ifndef _H_IOP_RPC_LIBIOP
+#define _H_IOP_RPC_LIBIOP
+
+#include "iop.h"
+
+//
+// iopr 单连接流水线 rpc 客户端, 只能在所属 iopbase 的调度线程中使用
+// 请求和响应都是 [len 4 字节][id 4 字节][body len 字节], 网络字节序, 响应按 id 找回请求
+//
+typedef struct iopr * iopr_t;
+
+#define IOPR_HEAD       (8)         // 帧头长度
+
+//
+// iopr_f - 请求结果回调
+// r        : rpc 客户端
+// code     : SBase 成功, ETout 超时, EClose 连接断开或者客户端销毁
+// data     : 响应 body, 只在回调中有效
+// len      : 响应 body 长度
+// arg      : iopr_call 传入的用户参数
+// return   : void
+//
+typedef void (* iopr_f)(iopr_t r, int code, const char * data, uint32_t len, void * arg);
+
+//
+// iopr_create - 创建 rpc 客户端, 第一次 iopr_call 时才建立连接, 断开后下一次调用自动重连
+// base     : io 调度对象
+// host     : ip:port 串
+// to       : 连接超时毫秒数, 也是 iopr_call 传 0 时的默认请求超时
+// return   : 失败返回 NULL
+//
+extern iopr_t iopr_create(iopbase_t base, const char * host, uint32_t to);
+
+//
+// iopr_delete - 关闭连接并销毁客户端, 还没有结果的请求回调 EClose
+// 可以在 iopr_f 回调中调用, 内存等最外层回调返回后再释放
+// r        : iopr_create 返回的对象
+// return   : void
+//
+extern void iopr_delete(iopr_t r);
+
+//
+// iopr_call - 发起一次请求, 不等响应, 同一连接上可以同时有很多请求在路上
+// r        : rpc 客户端
+// data     : 请求 body
+// len      : 请求 body 长度
+// to       : 请求超时毫秒数, 按 iopbase 时钟计时, 0 表示用 iopr_create 的 to
+// fcall    : 结果回调, 只回调一次
+// arg      : 用户参数
+// return   : 成功返回请求 id, 失败返回 EBase 并且不会回调
+//
+extern uint32_t iopr_call(iopr_t r, const void * data, uint32_t len, uint32_t to, iopr_f fcall, void * arg);
+
+#endif//_H_IOP_RPC_LIBIOP
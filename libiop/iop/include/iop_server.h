@@ -7,10 +7,31 @@
 // ios iop server 服务对象
 typedef struct iops * iops_t;
 
+//
+// IOPS_XXX 是 iops 新连接分发到调度线程的方式
+//
+#define IOPS_REUSEPORT  (0)         // 每个调度线程各自监听, 内核 SO_REUSEPORT 分流
+#define IOPS_ROUND      (1)         // 独立 accept 线程, 轮流分发给调度线程
+#define IOPS_LEAST      (2)         // 独立 accept 线程, 分发给连接数最少的调度线程
+
+//
+// iopsopt - iop server 扩展配置, 字段填 0 表示走默认值
+//
+struct iopsopt {
+    uint32_t nthread;       // 调度线程数, 每个线程独享一个 iopbase, 默认 1
+    uint32_t maxio;         // 每个 iopbase 最大并发数, 默认 INT_IOP
+    uint32_t balance;       // 新连接分发方式 IOPS_XXX, 默认 IOPS_REUSEPORT
+    uint32_t flags;         // iopbase 特性 IOP_F_XXX, IOP_F_ET 时读写做到 EAGAIN 并且 EV_WRITE 常驻
+    uint32_t budget;        // 每个连接每次唤醒最多处理的包数, 用完挂到就绪链表下一轮接着处理, 默认不限
+    uint32_t naccept;       // 监听每次唤醒最多 accept 的连接数, 默认 INT_ACCEPT
+    iop_parsex_f fparsex;   // 带游标的协议解析器, 不为 NULL 时替代 fparser, 数据没到 need 之前不调用
+    iop_chunk_f fchunk;     // 流式 body 处理器, fparsex 设置 cur->body 后紧跟的 body 边收边交给它, 不受 INT_RECV 限制
+};
+
 //
 // iops_create - 创建 iop tcp server 对象并开始监听处理
 // host        : 服务器地址 ip:port
-// timeout     : 超时时间阀值
+// timeout     : 超时毫秒阀值, '-1' 表示永不超时
 // fparser     : 协议解析器
 // fprocessor  : 数据处理器
 // fconnect    : 当连接创建时候回调
@@ -26,6 +47,27 @@ extern iops_t iops_create(const char * host,
                           iop_f fdestroy, 
                           iop_event_f ferror);
 
+//
+// iops_create_ex - 按扩展配置创建 iop tcp server 对象并开始监听处理
+// host        : 服务器地址 ip:port
+// opt         : 扩展配置, NULL 表示全部默认
+// timeout     : 超时毫秒阀值, '-1' 表示永不超时
+// fparser     : 协议解析器, 所有调度线程共用
+// fprocessor  : 数据处理器, 所有调度线程共用
+// fconnect    : 当连接创建时候回调
+// fdestroy    : 退出时候的回调
+// ferror      : 错误的时候回调
+// return      : NULL is error, iops_delete 会采用同步方式结束
+//
+extern iops_t iops_create_ex(const char * host, 
+                             const struct iopsopt * opt, 
+                             uint32_t timeout, 
+                             iop_parse_f fparser, 
+                             iop_processor_f fprocessor, 
+                             iop_f fconnect, 
+                             iop_f fdestroy, 
+                             iop_event_f ferror);
+
 //
 // iops_delete - 结束一个 ios 服务
 // p           : iops_create 返回的对象
@@ -1,40 +1,72 @@
 ﻿#include "iop.h"
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
 // iop_event - 默认 event 调度事件
 inline static int iop_event(iopbase_t base, uint32_t id, uint32_t event, void * arg) {
     return SBase;
 }
 
-// 构建对象
-static iopbase_t iopbase_new(uint32_t maxio) {
-    iop_t iop;
-    uint32_t i = 0, prev = INVALID_SOCKET;
-    iopbase_t base = calloc(1, 
-                            sizeof(struct iopbase) + maxio * sizeof(struct iop));
+// 构建对象, ios 分块表按 maxio 一次分配, iop 块按需分配
+static iopbase_t iopbase_new(uint32_t maxio, uint32_t flags) {
+    iopbase_t base = calloc(1, sizeof(struct iopbase));
+    base->ios = calloc((maxio >> INT_IOPBIT) + 1, sizeof(iop_t));
 
     // 开始部署数据
     base->maxio = maxio;
+    base->flags = flags;
     base->dispatch = INT_DISPATCH;
-    base->last = time(&base->curt);
-    base->keepalive = base->curt;
+    base->curt = mstime();
+    twheel_init(&base->wheel, base->curt);
     base->iohead = INVALID_SOCKET;
-    base->freetail = maxio - 1;
+    base->freehead = INVALID_SOCKET;
+    base->freetail = INVALID_SOCKET;
     base->fdel = iop_del;
-    // 构建具体的处理
-    while (i < maxio) {
-        iop = base->ios + i;
-        iop->id = i;
-        iop->s = INVALID_SOCKET;
-        iop->fevent = iop_event;
+    mpsc_init(&base->posts);
+    base->wfd = INVALID_SOCKET;
+    if (flags & IOP_F_RSHARE)
+        tbuf_expand(base->rbuf, INT_RECV);
 
-        iop->prev = prev;
-        prev = i;
-        iop->next = ++i;
+    return base;
+}
+
+// iop_wake_event - eventfd 可读只需清空计数, 投递的消息在下一轮调度开始时处理
+static int iop_wake_event(iopbase_t base, uint32_t id, uint32_t events, void * arg) {
+    if (events & EV_READ) {
+        uint64_t n;
+        read(iop_get(base, id)->s, &n, sizeof n);
     }
-    // 链表最后结点指向 INVALID_SOCKET
-    iop->next = INVALID_SOCKET;
+    return SBase;
+}
 
-    return base;
+// iop_wake_init - 构建跨线程唤醒句柄, 没有 eventfd 的平台靠 INT_DISPATCH 间隔兜底
+static int iop_wake_init(iopbase_t base) {
+#ifdef __linux__
+    socket_t fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < SBase) {
+        RETURN(EFd, "eventfd is error");
+    }
+    if (SOCKET_ERROR == iop_add(base, fd, EV_NBLOCK | EV_READ, -1, iop_wake_event, NULL)) {
+        close(fd);
+        RETURN(EBase, "iop_add eventfd is error fd = %d", fd);
+    }
+    base->wfd = fd;
+#endif
+    return SBase;
+}
+
+// iop_posts - 调度线程处理投递过来的消息
+static void iop_posts(iopbase_t base) {
+    struct mpscnode * node;
+    if (ATOM_LOAD(&base->wake) == 0)
+        return;
+
+    // 先清唤醒标识再取消息, 之后的投递者会重新唤醒
+    ATOM_STORE(&base->wake, 0);
+    while ((node = mpsc_pop(&base->posts)))
+        ((struct ioppost *)node)->fpost(base, (struct ioppost *)node);
 }
 
 //
@@ -43,11 +75,33 @@ static iopbase_t iopbase_new(uint32_t maxio) {
 //
 inline iopbase_t 
 iop_create(void) {
-    iopbase_t base = iopbase_new(INT_IOP);
+    return iop_create_ex(INT_IOP, 0);
+}
+
+//
+// iop_create_ex - 创建新的 iopbase_t 对象, 指定最大 io 数量和特性
+// maxio    : 最大并发 io 数量, 0 表示默认 INT_IOP, 最大 IOP_IDMASK. ios 会按块逐步扩容到 maxio
+// flags    : 特性标识 IOP_F_XXX, 构建后以 base->flags 为准
+// return   : 失败返回 NULL
+//
+iopbase_t 
+iop_create_ex(uint32_t maxio, uint32_t flags) {
+    iopbase_t base;
+    if (maxio == 0)
+        maxio = INT_IOP;
+    // id 中只有 IOP_IDBIT 位留给下标
+    if (maxio > IOP_IDMASK)
+        maxio = IOP_IDMASK;
+
+    base = iopbase_new(maxio, flags);
     if (SBase > iop_poll(base)) {
         iop_delete(base);
         RETNUL("iop_poll_init base error!");
     }
+    if (SBase > iop_wake_init(base)) {
+        iop_delete(base);
+        RETNUL("iop_wake_init base error!");
+    }
     return base;
 }
 
@@ -60,17 +114,28 @@ void
 iop_delete(iopbase_t base) {
     if (!base) return;
     if (base->ios) {
+        // 还没处理的投递消息先处理掉, 让其释放自身资源
+        iop_posts(base);
         while (base->iohead != INVALID_SOCKET)
             iop_del(base, base->iohead);
+        base->wfd = INVALID_SOCKET;
 
-        for (uint32_t i = 0; i < base->maxio; ++i) {
-            iop_t iop = base->ios + i;
-            TSTR_DELETE(iop->suf);
-            TSTR_DELETE(iop->ruf);
+        for (uint32_t i = 0; i < base->capio; ++i) {
+            iop_t iop = iop_get(base, i);
+            iopsq_clear(iop->suf);
+            TBUF_DELETE(iop->ruf);
         }
 
-        base->maxio = 0;
+        // 释放所有 iop 块
+        for (uint32_t i = 0; i < base->capio; i += 1 << INT_IOPBIT)
+            free(base->ios[i >> INT_IOPBIT]);
+        free(base->ios);
+        base->ios = NULL;
+        base->capio = base->maxio = 0;
     }
+    TBUF_DELETE(base->rbuf);
+    free(base->dirty);
+    free(base->ready);
 
     if (base->op.ffree)
         base->op.ffree(base);
@@ -78,6 +143,79 @@ iop_delete(iopbase_t base) {
     free(base);
 }
 
+// iop_idpush - id 追加到按倍数扩容的 id 表
+static int iop_idpush(uint32_t ** ids, uint32_t * n, uint32_t * cap, uint32_t id) {
+    if (*n >= *cap) {
+        uint32_t c = *cap ? *cap << 1 : INT_IDS;
+        uint32_t * p = realloc(*ids, c * sizeof(uint32_t));
+        if (NULL == p) {
+            RETURN(EAlloc, "realloc ids error cap = %u", c);
+        }
+        *ids = p;
+        *cap = c;
+    }
+    (*ids)[(*n)++] = id;
+    return SBase;
+}
+
+// iop_readys - 回调上一轮挂到就绪链表的 iop, 回调中重新挂上的留到下一轮
+static void iop_readys(iopbase_t base) {
+    uint32_t i, n = base->nready;
+    for (i = 0; i < n; ++i) {
+        iop_t iop = iop_find(base, base->ready[i]);
+        if (iop && iop->ready) {
+            iop->ready = false;
+            iop_callback(base, iop, EV_READY);
+        }
+    }
+    base->nready -= n;
+    memmove(base->ready, base->ready + n, base->nready * sizeof(uint32_t));
+}
+
+// iop_flush - IOP_F_CORK 下把本轮攒下的发送一次 writev 刷出, 剩下的等 EV_WRITE
+static void iop_flush(iopbase_t base) {
+    uint32_t i, id;
+    for (i = 0; i < base->ndirty; ++i) {
+        int n;
+        iop_t iop = iop_find(base, id = base->dirty[i]);
+        // 中途关闭的连接 dirty 已经清掉, 下标也可能被新连接复用
+        if (NULL == iop || !iop->dirty)
+            continue;
+        iop->dirty = false;
+
+        if (iop->event & EV_RECV) {
+            if (base->op.fsend(base, iop) < SBase)
+                base->fdel(base, id);
+            continue;
+        }
+
+        while (iop->suf->len > 0) {
+            n = iop_sendv(iop);
+            if (n > SBase)
+                continue;
+            if (n < SBase && errno == EINTR)
+                continue;
+            if (n < SBase && errno != EAGAIN) {
+                CERR("iop_sendv error id = %u, n = %d", id, n);
+                base->fdel(base, id);
+                iop = NULL;
+            }
+            break;
+        }
+        if (iop && iop_wlow(base, iop) < SBase) {
+            base->fdel(base, id);
+            continue;
+        }
+
+        // 没发完的等可写, 边缘触发模式下 EV_WRITE 常驻
+        if (iop && iop->suf->len > 0 && !(iop->event & EV_WRITE)) {
+            if (iop_mod(base, id, iop->event | EV_WRITE) < SBase)
+                base->fdel(base, id);
+        }
+    }
+    base->ndirty = 0;
+}
+
 //
 // iop_dispatch - 启动一次事件调度
 // base     : io 调度对象
@@ -85,44 +223,103 @@ iop_delete(iopbase_t base) {
 //
 int 
 iop_dispatch(iopbase_t base) {
-    int r = base->op.fdispatch(base, base->dispatch);
+    int r;
+    // 先处理其它线程投递过来的消息
+    iop_posts(base);
+
+    // 上一轮没处理完的 iop 先处理, 还有就绪的就不阻塞等待
+    if (base->nready > 0)
+        iop_readys(base);
+
+    // 投递和就绪回调里攒下的发送先刷出, 不然要等 poll 超时返回才发
+    if (base->ndirty > 0)
+        iop_flush(base);
+
+    // 有 iop 快到期时缩短等待, 保证毫秒级超时精度
+    r = base->op.fdispatch(base, base->nready > 0 ? 0 : twheel_wait(&base->wheel, base->dispatch));
     // 调度一次结果监测
     if (r < SBase)
         return r;
 
-    // 判断时间信息
-    if (base->curt > base->last) {
-        // clear keepalive, 60 seconds per times
-        if (base->curt > base->keepalive + INT_KEEPALIVE) {
-            int curid = base->iohead;
-            base->keepalive = base->curt;
-            while (curid != INVALID_SOCKET) {
-                iop_t iop = base->ios + curid;
-                int nextid = iop->next;
-                if (iop->timeout > 0 && iop->last + iop->timeout < base->curt)
-                    iop_callback(base, iop, EV_TIMEOUT);
-                curid = nextid;
-            }
-        }
+    // 时间轮推进, 只处理到期的格子
+    twheel_update(&base->wheel, base->curt, base);
 
-        base->last = base->curt;
-    }
+    // 本轮所有回调都处理完, 再统一刷出攒下的发送
+    if (base->ndirty > 0)
+        iop_flush(base);
 
     return r;
 }
 
-// iop_get - 得到一个可用 iop 对象
-inline iop_t iop_get(iopbase_t base) {
-    iop_t iop = NULL;
-    if (base->freehead != INVALID_SOCKET) {
-        // 存在释放结点, 找出来处理
-        iop = base->ios + base->freehead;
-        base->freehead = iop->next;
-        if (base->freehead == INVALID_SOCKET)
-            base->freetail = INVALID_SOCKET;
-        else
-            base->ios[base->freehead].prev = INVALID_SOCKET;
+// iop_arm - iop 超时节点按 last + timeout 挂到时间轮上, '0' 和 '-1' 表示永不超时
+inline static void iop_arm(iopbase_t base, iop_t iop) {
+    if (iop->timeout > 0 && iop->timeout != (uint32_t)-1 && !iop->timer.prev)
+        twheel_add(&base->wheel, &iop->timer, iop->last + iop->timeout);
+}
+
+// iop_expire - 时间轮到期回调, last 被刷新过就顺延, 否则触发 EV_TIMEOUT
+static void iop_expire(struct tnode * node, void * arg) {
+    iopbase_t base = arg;
+    iop_t iop = (iop_t)((char *)node - offsetof(struct iop, timer));
+
+    // iop_callback 只刷新 last, 这里惰性顺延, 活跃连接不用反复挂载
+    if (iop->last + iop->timeout > base->curt) {
+        iop_arm(base, iop);
+        return;
     }
+
+    iop_callback(base, iop, EV_TIMEOUT);
+    // 回调中可能已经 iop_del, 仍然存活则开始下一轮计时
+    if (iop->type != IOP_FREE)
+        iop_arm(base, iop);
+}
+
+// iop_grow - ios 扩容一块 iop, 并挂到可用链表上, 已有 iop 地址不变
+static int iop_grow(iopbase_t base) {
+    iop_t iop;
+    uint32_t i = base->capio, prev = INVALID_SOCKET, end;
+    if (i >= base->maxio)
+        return EAlloc;
+
+    iop = calloc(1 << INT_IOPBIT, sizeof(struct iop));
+    if (NULL == iop)
+        return EAlloc;
+    base->ios[i >> INT_IOPBIT] = iop;
+    base->capio = i + (1 << INT_IOPBIT);
+
+    // 只有 maxio 以内的 iop 才能被使用
+    end = base->capio < base->maxio ? base->capio : base->maxio;
+    base->freehead = i;
+    while (i < end) {
+        iop = iop_get(base, i);
+        iop->id = i;
+        iop->s = INVALID_SOCKET;
+        iop->fevent = iop_event;
+
+        iop->prev = prev;
+        prev = i;
+        iop->next = ++i;
+    }
+    // 链表最后结点指向 INVALID_SOCKET
+    iop->next = INVALID_SOCKET;
+    base->freetail = prev;
+
+    return SBase;
+}
+
+// iop_new - 得到一个可用 iop 对象, 可用链表为空时扩容
+inline static iop_t iop_new(iopbase_t base) {
+    iop_t iop;
+    if (base->freehead == INVALID_SOCKET && iop_grow(base) < SBase)
+        return NULL;
+
+    // 存在释放结点, 找出来处理
+    iop = iop_get(base, base->freehead);
+    base->freehead = iop->next;
+    if (base->freehead == INVALID_SOCKET)
+        base->freetail = INVALID_SOCKET;
+    else
+        iop_get(base, base->freehead)->prev = INVALID_SOCKET;
     return iop;
 }
 
@@ -140,10 +337,15 @@ uint32_t
 iop_add(iopbase_t base,
     socket_t s, uint32_t event, uint32_t to, iop_event_f fevent, void * arg) {
     int r;
-    iop_t iop = iop_get(base);
+    uint32_t nblock;
+    iop_t iop = iop_new(base);
     if (NULL == iop) {
-        RETURN(EBase, "iop_get base is error = %p", base);
+        RETURN(EBase, "iop_new base is error = %p, maxio = %u", base, base->maxio);
     }
+    if (!(base->flags & IOP_F_UIO))
+        event &= ~EV_RECV;
+    nblock = event & EV_NBLOCK;
+    event &= ~EV_NBLOCK;
 
     iop->s = s;
     iop->event = event;
@@ -151,17 +353,24 @@ iop_add(iopbase_t base,
     iop->fevent = fevent;
     iop->last = base->curt;
     iop->arg = arg;
+    iop->whigh = INT_SEND;
+    iop->wlow = INT_SENDLOW;
+    iop->timer.fexpire = iop_expire;
+    iop_arm(base, iop);
 
     if (s != INVALID_SOCKET) {
         iop->prev = INVALID_SOCKET;
         iop->next = base->iohead;
         if (base->iohead != INVALID_SOCKET)
-            base->ios[base->iohead].prev = iop->id;
+            iop_get(base, base->iohead)->prev = iop->id;
         base->iohead = iop->id;
         iop->type = IOP_IO;
-        socket_set_nonblock(s);
+        if (!nblock)
+            socket_set_nonblock(s);
         r = base->op.fadd(base, iop->id, s, event);
         if (r < SBase) {
+            // s 交还调用方处理
+            iop->s = INVALID_SOCKET;
             iop_del(base, iop->id);
             return EBase;
         }
@@ -170,42 +379,224 @@ iop_add(iopbase_t base,
     return iop->id;
 }
 
+//
+// iopconn - iop_connect 连接中暂存的用户回调, 连上后还给 iop
+//
+struct iopconn {
+    iop_event_f fevent;
+    void * arg;
+    bool live;              // iop_add 成功后才交给 iop_connecting 释放
+};
+
+// iop_connecting - 连接中的事件回调, 可写时检查 SO_ERROR 得到连接结果
+static int iop_connecting(iopbase_t base, uint32_t id, uint32_t events, void * arg) {
+    int err;
+    iop_t iop;
+    struct iopconn * c = arg;
+    if (events & EV_DELETE) {
+        // iop_add 失败时也会 iop_del, 这时 c 由 iop_connect 释放, 也不通知用户
+        if (!c->live)
+            return SBase;
+        err = c->fevent(base, id, EV_DELETE, c->arg);
+        free(c);
+        return err;
+    }
+
+    if (events & EV_TIMEOUT)
+        err = ETIMEDOUT;
+    else {
+        iop = iop_get(base, id);
+        err = socket_get_error(iop->s);
+        // 出错时读写都会通知, 没出错只有可写才算连上
+        if (err == 0) {
+            if (!(events & EV_WRITE))
+                return SBase;
+
+            iop->fevent = c->fevent;
+            iop->arg = c->arg;
+            free(c);
+            // 连接中就被暂停读的, EV_READ 先扣下, 恢复时再加
+            iop->rhold = iop->rpause > 0;
+            if ((err = iop_mod(base, id, iop->rhold ? 0 : EV_READ)) < SBase)
+                return err;
+            return iop->fevent(base, id, EV_CONNECT, iop->arg);
+        }
+    }
+
+    // 返回 EBase 交给 iop_callback 删除, EV_DELETE 时再释放 c
+    socket_set_errno(err);
+    c->fevent(base, id, EV_ERROR, c->arg);
+    return EBase;
+}
+
+//
+// iop_connect - 发起非阻塞连接, 结果通过 fevent 通知, 调用线程不等待
+// base     : io 调度对象
+// host     : ip:port 串, 域名解析仍然是同步的
+// to       : 超时毫秒数, 连接中超时回调 EV_ERROR, 连上后就是普通的 iop 超时, '-1' 表示永不超时
+// fevent   : 事件回调函数, 连上时回调 EV_CONNECT, 此后关注 EV_READ; 失败回调 EV_ERROR 后删除
+// arg      : 用户参数
+// return   : 成功返回 iop 的 id, 连接结果还没出来; 失败返回 EBase
+//
+uint32_t 
+iop_connect(iopbase_t base, const char * host, uint32_t to, iop_event_f fevent, void * arg) {
+    uint32_t id;
+    sockaddr_t addr;
+    socket_t s;
+    struct iopconn * c;
+    if (socket_host(host, addr) < SBase) {
+        RETURN(EBase, "socket_host error host = %s", host);
+    }
+
+    s = socket_stream();
+    if (INVALID_SOCKET == s) {
+        RETURN(EBase, "socket_stream error host = %s", host);
+    }
+    // connect 链接中, linux 是 EINPROGRESS，winds 是 WSAEWOULDBLOCK
+    if (socket_set_nonblock(s) < SBase || (socket_connect(s, addr) < SBase && errno != EINPROGRESS)) {
+        socket_close(s);
+        RETURN(EBase, "socket_connect error host = %s", host);
+    }
+
+    c = malloc(sizeof(struct iopconn));
+    if (NULL == c) {
+        socket_close(s);
+        RETURN(EBase, "malloc iopconn error host = %s", host);
+    }
+    c->fevent = fevent;
+    c->arg = arg;
+    c->live = false;
+
+    // 立即连上的也等一次可写, 结果统一在 iop_connecting 中回调
+    id = iop_add(base, s, EV_NBLOCK | EV_WRITE, to, iop_connecting, c);
+    if (SOCKET_ERROR == id) {
+        free(c);
+        socket_close(s);
+        RETURN(EBase, "iop_add error host = %s", host);
+    }
+    c->live = true;
+    return id;
+}
+
+//
+// iop_post - 投递消息到 base 的调度线程执行, 任意线程都可以调用
+// base     : io 调度对象
+// post     : 待投递消息, fpost 需要提前设置
+// return   : void
+//
+void 
+iop_post(iopbase_t base, struct ioppost * post) {
+    mpsc_push(&base->posts, &post->node);
+
+    // 只有第一个投递者负责唤醒, 省掉多余的 write 系统调用
+    if (ATOM_XCHG(&base->wake, 1) == 0 && base->wfd != INVALID_SOCKET) {
+        uint64_t n = 1;
+        write(base->wfd, &n, sizeof n);
+    }
+}
+
+//
+// iopsend - iop_post_send 投递的待发送数据
+//
+struct iopsend {
+    struct ioppost post;
+    uint32_t id;
+    uint32_t len;
+    char data[];
+};
+
+// iop_post_sent - 调度线程中发送 iop_post_send 投递过来的数据
+static void iop_post_sent(iopbase_t base, struct ioppost * post) {
+    struct iopsend * m = (struct iopsend *)post;
+    // 投递期间连接可能已经关闭, 代数不对说明下标已经被新连接复用
+    if (iop_find(base, m->id)) {
+        if (iop_send(base, m->id, m->data, m->len) < SBase)
+            base->fdel(base, m->id);
+    }
+    free(m);
+}
+
+//
+// iop_post_send - 跨线程发送数据, 数据复制后投递给调度线程去 iop_send, 任意线程都可以调用
+// base     : io 调度对象
+// id       : iop 对象的 id
+// data     : 待发送数据
+// len      : 数据长度
+// return   : >= SBase 表示投递成功, 连接在发送前已经关闭时数据直接丢弃
+//
+int 
+iop_post_send(iopbase_t base, uint32_t id, const void * data, uint32_t len) {
+    struct iopsend * m = malloc(sizeof(struct iopsend) + len);
+    if (NULL == m) {
+        RETURN(EAlloc, "malloc error id = %u, len = %u", id, len);
+    }
+
+    m->post.fpost = iop_post_sent;
+    m->id = id;
+    m->len = len;
+    memcpy(m->data, data, len);
+    iop_post(base, &m->post);
+    return SBase;
+}
+
 //
 // iop_del - iop 销毁事件
 // base     : io 调度对象
 // id       : iop 事件 id
-// return   : >=0 成功, <0 表示失败
+// return   : >=0 成功, <0 表示失败, id 已经失效返回 EParam
 //
 int 
 iop_del(iopbase_t base, uint32_t id) {
-    iop_t iop = base->ios + id;
+    iop_t iop = iop_find(base, id);
+    if (NULL == iop) {
+        RETURN(EParam, "iop_del id is invalid = %u", id);
+    }
+
     switch (iop->type) {
     case IOP_IO:
         iop->fevent(base, id, EV_DELETE, iop->arg);
+        twheel_del(&base->wheel, &iop->timer);
         if (iop->s != INVALID_SOCKET) {
             base->op.fdel(base, iop->id, iop->s);
             socket_close(iop->s);
             iop->s = INVALID_SOCKET;
         }
+        // 缓冲区留给下一个连接复用, 数据要清掉
+        iopsq_clear(iop->suf);
+        tbuf_clear(iop->ruf);
+        if (base->rid == id)
+            tbuf_clear(base->rbuf);
+        iop->rn = 0;
+        iop->sflight = 0;
+        // srg 的类型由上层各自约定, 不能留给复用这个位置的下一个连接
+        iop->srg = NULL;
+        iop->sending = NULL;
+        iop->rstop = iop->dirty = iop->ready = iop->wfull = false;
+        iop->rpause = 0;
+        iop->rhold = false;
+        memset(iop->cur, 0, sizeof *iop->cur);
+        iop->rbody = 0;
 
         // INVALID_SOCKET 充当链表空节点, 头节点处理涉及 iohead
         if (iop->prev == INVALID_SOCKET) {
             base->iohead = iop->next;
             if (base->iohead != INVALID_SOCKET)
-                base->ios[base->iohead].prev = INVALID_SOCKET;
+                iop_get(base, base->iohead)->prev = INVALID_SOCKET;
         } else {
-            iop_t node = base->ios + iop->prev;
+            iop_t node = iop_get(base, iop->prev);
             node->next = iop->next;
             if (node->next != INVALID_SOCKET)
-                base->ios[node->next].prev = node->id;
+                iop_get(base, node->next)->prev = node->id;
         }
 
+        // 代数加一后再挂到可用链表尾, 旧 id 从此失效
+        iop->id = (iop->id + (1u << IOP_IDBIT)) & (IOP_IDGEN | IOP_IDMASK);
         if (base->freehead == INVALID_SOCKET)
             base->freehead = iop->id;
         iop->prev = base->freetail;
         iop->next = INVALID_SOCKET;
         if (base->freetail != INVALID_SOCKET)
-            base->ios[base->freetail].next = iop->id;
+            iop_get(base, base->freetail)->next = iop->id;
         base->freetail = iop->id;
         break;
     default:
@@ -225,7 +616,10 @@ iop_del(iopbase_t base, uint32_t id) {
 //
 int 
 iop_mod(iopbase_t base, uint32_t id, uint32_t events) {
-    iop_t iop = base->ios + id;
+    iop_t iop = iop_find(base, id);
+    if (NULL == iop) {
+        RETURN(EParam, "iop_mod id is invalid = %u", id);
+    }
     if (iop->type != IOP_IO) {
         RETURN(EBase, "iop error type = %u, %u", iop->type, id);
     }
@@ -233,16 +627,174 @@ iop_mod(iopbase_t base, uint32_t id, uint32_t events) {
         RETURN(EBase, "iop socket error is %"PRIu64", %u", (int64_t)iop->s, id);
     }
 
-    return base->op.fmod(base, iop->id, iop->s, events);
+    if (base->op.fmod(base, iop->id, iop->s, events) < SBase) {
+        RETURN(EBase, "fmod error id = %u, events = %u", id, events);
+    }
+    iop->event = events;
+    return SBase;
 }
 
-// iop_xxxx 轮询事件的发送接收操作, 发送没变化, 接收放在接收缓冲区
+//
+// iop_ready - iop 挂到就绪链表, 下一轮 poll 之前回调 EV_READY, 这一轮不会阻塞等待
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
 int
-iop_send(iopbase_t base, uint32_t id, const void * data, uint32_t len) {
-    iop_t iop = base->ios + id;
-    const char * str = data;
-    tstr_t buf = iop->suf;
+iop_ready(iopbase_t base, uint32_t id) {
+    iop_t iop = iop_find(base, id);
+    if (NULL == iop) {
+        RETURN(EParam, "iop_ready id is invalid = %u", id);
+    }
+    if (iop->ready)
+        return SBase;
+    if (iop_idpush(&base->ready, &base->nready, &base->cready, id) < SBase)
+        return EAlloc;
+    iop->ready = true;
+    return SBase;
+}
+
+//
+// iop_timeout - 修改 iop 超时时间, 从现在开始重新计时
+// base     : io 调度对象
+// id       : iop 对象的 id
+// to       : 超时毫秒数, '-1' 表示永不超时
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+int
+iop_timeout(iopbase_t base, uint32_t id, uint32_t to) {
+    iop_t iop = iop_find(base, id);
+    if (NULL == iop) {
+        RETURN(EParam, "iop_timeout id is invalid = %u", id);
+    }
+    twheel_del(&base->wheel, &iop->timer);
+    iop->timeout = to;
+    iop->last = base->curt;
+    iop_arm(base, iop);
+    return SBase;
+}
+
+//
+// iop_pause_read - 暂停读, 从后端去掉 EV_READ, ruf 中已经收到的数据保留
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+int
+iop_pause_read(iopbase_t base, uint32_t id) {
+    iop_t iop = iop_find(base, id);
+    if (NULL == iop) {
+        RETURN(EParam, "iop_pause_read id is invalid = %u", id);
+    }
+    // 多个暂停原因各自计数, 只有第一次真正修改后端, 本来就不读的恢复时也不加
+    if (iop->rpause++ > 0 || !(iop->event & EV_READ))
+        return SBase;
+    iop->rhold = true;
+    return iop_mod(base, id, iop->event & ~EV_READ);
+}
+
+//
+// iop_resume_read - 恢复读, 和 iop_pause_read 成对调用, 计数归零时才重新关注 EV_READ, 暂停前就不读的保持不读
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+int
+iop_resume_read(iopbase_t base, uint32_t id) {
+    iop_t iop = iop_find(base, id);
+    if (NULL == iop) {
+        RETURN(EParam, "iop_resume_read id is invalid = %u", id);
+    }
+    if (iop->rpause == 0 || --iop->rpause > 0 || !iop->rhold)
+        return SBase;
+    iop->rhold = false;
+    if (iop->event & EV_READ)
+        return SBase;
+    // 边缘触发下 epoll_ctl 和 io_uring poll 更新都会重新检查就绪状态, 暂停期间到达的数据不会丢
+    return iop_mod(base, id, iop->event | EV_READ);
+}
+
+// iop_whigh - 数据进队列后检查高水位, 越过时回调一次 EV_WHIGH
+inline static int iop_whigh(iopbase_t base, iop_t iop) {
+    if (!iop->wfull && iop->suf->len + iop->sflight > iop->whigh) {
+        iop->wfull = true;
+        return iop->fevent(base, iop->id, EV_WHIGH, iop->arg);
+    }
+    return SBase;
+}
+
+//
+// iop_wlow - 发送后检查队列是否回落到低水位, 是就回调 EV_WLOW
+// base     : io 调度对象
+// iop      : iop 对象
+// return   : 回调的返回值, < SBase 表示调用方需要删除 iop
+//
+int
+iop_wlow(iopbase_t base, iop_t iop) {
+    if (iop->wfull && iop->suf->len + iop->sflight <= iop->wlow) {
+        iop->wfull = false;
+        return iop->fevent(base, iop->id, EV_WLOW, iop->arg);
+    }
+    return SBase;
+}
+
+//
+// iop_watermark - 设置发送队列高低水位, 默认 INT_SEND 和 INT_SENDLOW
+// base     : io 调度对象
+// id       : iop 对象的 id
+// high     : 高水位, 队列长度越过时回调 EV_WHIGH
+// low      : 低水位, EV_WHIGH 之后回落到不超过它时回调 EV_WLOW, 要小于 high
+// return   : >= SBase 成功, id 已经失效返回 EParam
+//
+int
+iop_watermark(iopbase_t base, uint32_t id, uint32_t high, uint32_t low) {
+    iop_t iop = iop_find(base, id);
+    if (NULL == iop) {
+        RETURN(EParam, "iop_watermark id is invalid = %u", id);
+    }
+    if (low >= high) {
+        RETURN(EParam, "iop_watermark low = %u >= high = %u", low, high);
+    }
+    iop->whigh = high;
+    iop->wlow = low;
+    return SBase;
+}
+
+// iop_enqueue - data 中 off 之后的数据进发送队列, ref 不为 NULL 时只引用
+inline static int iop_enqueue(struct iopsq * sq, const void * data, uint32_t len, iop_buf_t ref, uint32_t off) {
+    return ref ? iopsq_pushb(sq, ref, off) : iopsq_push(sq, (const char *)data + off, len - off);
+}
+
+// iop_sendb - 先直接发送, 剩下的进队列. ref 不为 NULL 时 data 就是 ref->data, 进队列只引用不复制
+static int iop_sendb(iopbase_t base, uint32_t id, const void * data, uint32_t len, iop_buf_t ref) {
+    iop_t iop = iop_find(base, id);
+    struct iopsq * buf;
     int n = 0;
+    if (NULL == iop) {
+        RETURN(EParam, "iop_send id is invalid = %u", id);
+    }
+    buf = iop->suf;
+
+    // 聚合模式只进队列, 本轮调度结束时统一发送
+    if (base->flags & IOP_F_CORK) {
+        if (!iop->dirty) {
+            if (iop_idpush(&base->dirty, &base->ndirty, &base->cdirty, id) < SBase)
+                return EAlloc;
+            iop->dirty = true;
+        }
+        if (iop_enqueue(buf, data, len, ref, 0) < SBase)
+            return EAlloc;
+        return iop_whigh(base, iop);
+    }
+
+    // 完成模式先攒到 suf, 由后端接管内存批量提交
+    if (iop->event & EV_RECV) {
+        if (iop_enqueue(buf, data, len, ref, 0) < SBase)
+            return EAlloc;
+        if ((n = iop_whigh(base, iop)) < SBase)
+            return n;
+        return base->op.fsend(base, iop);
+    }
 
     // 当前上一个发送缓存发送完毕, 才会继续发送
     if (buf->len <= 0) {
@@ -255,41 +807,277 @@ iop_send(iopbase_t base, uint32_t id, const void * data, uint32_t len) {
             }
             n = 0;
         }
-        str += n;
     }
 
-    // 剩余的发送部分, 下次再发. 并且简单检查是否超过发送缓冲区
-    if (buf->len > INT_SEND) {
-        RETURN(EAlloc, "iop->sbuf->capacity error too length = %zu", buf->len);
+    // 剩余的发送部分进队列, 下次可写时和其它积压一起 writev. 边缘触发模式下 EV_WRITE 常驻不用再修改
+    if (iop_enqueue(buf, data, len, ref, n) < SBase)
+        return EAlloc;
+    if ((n = iop_whigh(base, iop)) < SBase)
+        return n;
+    if (iop->event & EV_WRITE)
+        return SBase;
+
+    return iop_mod(base, id, iop->event | EV_WRITE);
+}
+
+// iop_xxxx 轮询事件的发送接收操作, 发送没变化, 接收放在接收缓冲区
+inline int
+iop_send(iopbase_t base, uint32_t id, const void * data, uint32_t len) {
+    return iop_sendb(base, id, data, len, NULL);
+}
+
+//
+// iop_buf_create - 创建引用计数为 1 的只读缓冲区
+// data     : 待复制的数据, NULL 时只分配, 由调用方填充 buf->data
+// len      : 数据长度
+// return   : 失败返回 NULL
+//
+iop_buf_t 
+iop_buf_create(const void * data, uint32_t len) {
+    iop_buf_t buf = malloc(sizeof(struct iopbuf) + len);
+    if (NULL == buf) {
+        RETNUL("malloc iopbuf error len = %u", len);
     }
+    buf->ref = 1;
+    buf->len = len;
+    if (data)
+        memcpy(buf->data, data, len);
+    return buf;
+}
 
-    // 开始填充内存
-    tstr_appendn(buf, str, len - n);
-    if (iop->event & EV_WRITE)
+//
+// iop_buf_delete - 释放一个引用, 计数到 0 时释放内存, 任意线程都可以调用
+// buf      : iop_buf_create 返回的对象
+// return   : void
+//
+inline void 
+iop_buf_delete(iop_buf_t buf) {
+    if (buf && ATOM_ADD(&buf->ref, -1) == 1)
+        free(buf);
+}
+
+//
+// iop_send_buf - 把 buf 挂到连接的发送队列上, 不复制数据, 成功时队列持有一个引用
+// base     : io 调度对象
+// id       : iop 对象的 id
+// buf      : 待发送的缓冲区, 调用方的引用不变
+// return   : >= SBase 成功, 和 iop_send 一致
+//
+inline int 
+iop_send_buf(iopbase_t base, uint32_t id, iop_buf_t buf) {
+    return iop_sendb(base, id, buf->data, buf->len, buf);
+}
+
+//
+// iop_broadcast - 同一份 buf 发给多个连接, 每个连接只增加引用不复制
+// base     : io 调度对象
+// ids      : iop id 数组, 已经失效的跳过
+// n        : ids 长度
+// buf      : 待发送的缓冲区, 调用方的引用不变, 发完后可以直接 iop_buf_delete
+// return   : 成功挂上的连接数
+//
+uint32_t 
+iop_broadcast(iopbase_t base, const uint32_t * ids, uint32_t n, iop_buf_t buf) {
+    uint32_t i, c = 0;
+    for (i = 0; i < n; ++i)
+        if (iop_sendb(base, ids[i], buf->data, buf->len, buf) >= SBase)
+            ++c;
+    return c;
+}
+
+//
+// iop_sendv - 把 iop->suf 中积压的多段数据一次 writev 尽量发出去, 发出的部分从队列弹出
+// iop      : iop 对象
+// return   : >= SBase 发送的字节数, < SBase 出错, 原因看 errno
+//
+int
+iop_sendv(iop_t iop) {
+    struct iovec iov[INT_IOV];
+    int n = iopsq_iov(iop->suf, iov, INT_IOV);
+    if (n <= 0)
         return SBase;
 
-    return iop_mod(base, id, iop->event | EV_WRITE);;
+    n = socket_sendv(iop->s, iov, n);
+    if (n > SBase)
+        iopsq_pop(iop->suf, n);
+    return n;
+}
+
+//
+// iopsq_push - 数据追加到发送队列尾, 尾段放得下就拼进去, 否则新开一段
+// sq       : 发送队列
+// data     : 待发送数据
+// len      : 数据长度
+// return   : >= SBase 成功, 内存不足返回 EAlloc, 队列不变
+//
+int
+iopsq_push(struct iopsq * sq, const void * data, uint32_t len) {
+    struct iopseg * seg = sq->tail;
+    if (NULL == seg || seg->buf || seg->cap - seg->tail < len) {
+        // 大数据单独一段按实际大小分配, 小数据至少 INT_SEG 留给后面的拼接
+        uint32_t cap = len > INT_SEG ? len : INT_SEG;
+        seg = malloc(sizeof(struct iopseg) + cap);
+        if (NULL == seg) {
+            RETURN(EAlloc, "malloc iopseg error len = %u", len);
+        }
+        seg->next = NULL;
+        seg->buf = NULL;
+        seg->head = seg->tail = 0;
+        seg->cap = cap;
+        if (sq->tail)
+            sq->tail->next = seg;
+        else
+            sq->head = seg;
+        sq->tail = seg;
+    }
+
+    memcpy(seg->data + seg->tail, data, len);
+    seg->tail += len;
+    sq->len += len;
+    return SBase;
+}
+
+//
+// iopsq_pushb - 引用 buf 中 off 之后的数据追加成一段, 不复制
+// sq       : 发送队列
+// buf      : 引用计数缓冲区, 段释放时归还引用
+// off      : 已经发送的长度
+// return   : >= SBase 成功, 内存不足返回 EAlloc, 队列和引用都不变
+//
+int
+iopsq_pushb(struct iopsq * sq, iop_buf_t buf, uint32_t off) {
+    struct iopseg * seg = malloc(sizeof(struct iopseg));
+    if (NULL == seg) {
+        RETURN(EAlloc, "malloc iopseg error len = %u", buf->len);
+    }
+    ATOM_ADD(&buf->ref, 1);
+    seg->next = NULL;
+    seg->buf = buf;
+    seg->head = off;
+    seg->tail = seg->cap = buf->len;
+    if (sq->tail)
+        sq->tail->next = seg;
+    else
+        sq->head = seg;
+    sq->tail = seg;
+    sq->len += buf->len - off;
+    return SBase;
+}
+
+//
+// iopsq_iov - 从队列头填充最多 n 个 iovec
+// sq       : 发送队列
+// iov      : 待填充的 iovec 数组
+// n        : iov 数组长度
+// return   : 填充的个数
+//
+int
+iopsq_iov(struct iopsq * sq, struct iovec * iov, int n) {
+    int i = 0;
+    struct iopseg * seg;
+    for (seg = sq->head; seg && i < n; seg = seg->next, ++i) {
+        iov[i].iov_base = (seg->buf ? seg->buf->data : seg->data) + seg->head;
+        iov[i].iov_len = seg->tail - seg->head;
+    }
+    return i;
+}
+
+//
+// iopsq_pop - 弹出已经发送的 len 字节, 发完的段直接释放
+// sq       : 发送队列
+// len      : 已经发送的长度
+// return   : void
+//
+void
+iopsq_pop(struct iopsq * sq, size_t len) {
+    struct iopseg * seg;
+    sq->len = len < sq->len ? sq->len - len : 0;
+    while ((seg = sq->head) && len > 0) {
+        size_t n = seg->tail - seg->head;
+        if (len < n) {
+            seg->head += (uint32_t)len;
+            break;
+        }
+        len -= n;
+        sq->head = seg->next;
+        iop_buf_delete(seg->buf);
+        free(seg);
+    }
+    if (NULL == sq->head)
+        sq->tail = NULL;
+}
+
+//
+// iopsq_clear - 释放队列中所有段
+// sq       : 发送队列
+// return   : void
+//
+void
+iopsq_clear(struct iopsq * sq) {
+    struct iopseg * seg;
+    while ((seg = sq->head)) {
+        sq->head = seg->next;
+        iop_buf_delete(seg->buf);
+        free(seg);
+    }
+    sq->tail = NULL;
+    sq->len = 0;
+}
+
+// iop_rspill - 共用接收缓冲区中还没处理完的数据搬回所属 iop 的 ruf
+static void iop_rspill(iopbase_t base) {
+    if (tbuf_len(base->rbuf) > 0) {
+        iop_t iop = iop_find(base, base->rid);
+        if (iop)
+            tbuf_appendn(iop->ruf, tbuf_str(base->rbuf), tbuf_len(base->rbuf));
+        tbuf_clear(base->rbuf);
+    }
 }
 
+//
+// iop_recv - 读取一次数据, IOP_F_RSHARE 且 ruf 为空时留在共用缓冲区, 否则追加到 iop->ruf 中
+// base     : io 调度对象
+// id       : iop 对象的 id
+// return   : > SBase 读到的字节数, SBase 暂时没有数据, EClose 对端关闭, 其它 < SBase 错误
+//
 int
 iop_recv(iopbase_t base, uint32_t id) {
-    iop_t iop = base->ios + id;
-    tstr_t buf = iop->ruf;
+    iop_t iop = iop_get(base, id);
+    tbuf_t buf = iop->ruf;
     int n;
 
-    if (buf->len > INT_RECV) {
-        RETURN(EAlloc, "iop->rbuf->capacity error too length = %zu", buf->len);
+    // 完成模式数据已经由后端按需收进 ruf, 这里只取走结果
+    // 暂停读之前已经完成的 recv 仍会追加, ruf 可能略超 INT_RECV, 上限由后端收数据时检查
+    if (iop->event & EV_RECV) {
+        n = iop->rn;
+        iop->rn = SBase;
+        if (n < SBase && n != EClose) {
+            CERR("io_uring recv error id = %u", id);
+            iop_del(base, id);
+        }
+        return n;
     }
 
-    // once init recv buf
-    if (buf->cap < INT_RECV)
-        tstr_expand(buf, INT_RECV);
+    if (tbuf_len(buf) >= INT_RECV) {
+        RETURN(EAlloc, "iop->rbuf->capacity error too length = %zu", tbuf_len(buf));
+    }
 
-    // 开始接收数据
-    n = socket_recv(iop->s, buf->str + buf->len, buf->cap - buf->len);
+    // 共用接收缓冲区, 先把上一个 iop 没处理完的数据搬走
+    if (base->flags & IOP_F_RSHARE) {
+        iop_rspill(base);
+        buf = base->rbuf;
+    } else {
+        // 有效数据加尾部空间凑够 INT_RECV, 尾部不够时才压缩
+        tbuf_expand(buf, INT_RECV - tbuf_len(buf));
+    }
+
+    // 开始接收数据, 信号打断直接重试, 边缘触发下不能丢掉这次可读
+    do
+        n = socket_recv(iop->s, buf->str + buf->tail, (int)(buf->cap - buf->tail));
+    while (n < 0 && errno == EINTR);
     if (n < 0) {
-        // 信号打断, 或者重试继续读取操作
-        if (errno == EINTR || errno == EAGAIN)
+        // 缓冲区已经读空
+        if (errno == EAGAIN)
             return SBase;
 
         CERR("socket_recv error = %d", n);
@@ -302,6 +1090,39 @@ iop_recv(iopbase_t base, uint32_t id) {
     if (n == 0)
         return EClose;
 
-    buf->len += n;
-    return SBase;
+    buf->tail += n;
+    if (buf == base->rbuf) {
+        // 已经有半包就拼到 ruf 后面, 否则留在共用缓冲区原地解析
+        if (tbuf_len(iop->ruf) > 0) {
+            tbuf_appendn(iop->ruf, tbuf_str(buf), n);
+            tbuf_clear(buf);
+        } else
+            base->rid = id;
+    }
+    return n;
+}
+
+//
+// iop_rpop - 弹出 iop_rbuf 头部已经处理的数据, 共用缓冲区剩下的尾包按实际大小搬进 iop->ruf
+// base     : io 调度对象
+// iop      : iop 对象
+// len      : 已经处理的长度
+// return   : void
+//
+void
+iop_rpop(iopbase_t base, iop_t iop, size_t len) {
+    tbuf_t buf = iop_rbuf(base, iop);
+    if (len < tbuf_len(buf)) {
+        if (buf == iop->ruf) {
+            tbuf_popup(buf, len);
+            return;
+        }
+        tbuf_appendn(iop->ruf, tbuf_str(buf) + len, tbuf_len(buf) - len);
+    } else if (buf == iop->ruf && (base->flags & IOP_F_RSHARE)) {
+        // 共用模式下 ruf 只在有半包时持有内存
+        TBUF_DELETE(buf);
+        buf->str = NULL;
+        buf->cap = 0;
+    }
+    tbuf_clear(buf);
 }
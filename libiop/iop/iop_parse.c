@@ -0,0 +1,225 @@
+﻿#include "iop_parse.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IOP_SSE2
+#endif
+
+// iop_ctz - 非 0 掩码最低位 1 的下标
+inline static int iop_ctz(uint32_t m) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return (int)i;
+#else
+    return __builtin_ctz(m);
+#endif
+}
+
+//
+// iop_memchr - 查找字节 c 第一次出现的位置, 有 SSE2/AVX2 时每次比较 16/32 字节
+// buf      : 待查找数据
+// len      : 数据长度
+// c        : 待查找的字节
+// return   : 找到返回位置, 否则返回 NULL
+//
+const char * 
+iop_memchr(const char * buf, uint32_t len, int c) {
+    const char * end = buf + len;
+#if defined(__AVX2__)
+    __m256i v32 = _mm256_set1_epi8((char)c);
+    for (; end - buf >= 32; buf += 32) {
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)buf), v32));
+        if (m) return buf + iop_ctz(m);
+    }
+#endif
+#ifdef IOP_SSE2
+    __m128i v16 = _mm_set1_epi8((char)c);
+    for (; end - buf >= 16; buf += 16) {
+        uint32_t m = (uint32_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)buf), v16));
+        if (m) return buf + iop_ctz(m);
+    }
+#endif
+    // 不到一个向量的尾巴, 没有 SIMD 时交给 libc
+    return memchr(buf, c, end - buf);
+}
+
+//
+// iop_parsex_delim - 按任意分隔符分帧, 没找到时记下扫描位置, 下次只扫新到的数据
+// buf      : 待解析数据
+// len      : 数据长度
+// delim    : 分隔符
+// dlen     : 分隔符长度, 大于 0
+// cur      : 解析游标
+// return   : 和 iop_parse_f 一致, > 0 时包含分隔符
+//
+int 
+iop_parsex_delim(const char * buf, uint32_t len, const char * delim, uint32_t dlen, struct iopcur * cur) {
+    const char * s = buf + cur->off, * end = buf + len;
+    // 按首字节向量扫描, 命中后再比较剩下的字节
+    while (end - s >= (ptrdiff_t)dlen) {
+        s = iop_memchr(s, (uint32_t)(end - s - dlen + 1), delim[0]);
+        if (NULL == s)
+            break;
+        if (!memcmp(s + 1, delim + 1, dlen - 1))
+            return (int)(s - buf + dlen);
+        ++s;
+    }
+    if (len >= INT_RECV) {
+        RETURN(EParse, "iop_parse_delim not found len = %u", len);
+    }
+
+    // 末尾不够一个分隔符的部分可能和新数据拼成分隔符, 要留着重扫
+    cur->off = len >= dlen ? len - dlen + 1 : 0;
+    cur->need = len + 1;
+    return SBase;
+}
+
+int 
+iop_parse_delim(const char * buf, uint32_t len, const char * delim, uint32_t dlen) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_delim(buf, len, delim, dlen, &cur);
+}
+
+int 
+iop_parsex_lf(const char * buf, uint32_t len, struct iopcur * cur) {
+    return iop_parsex_delim(buf, len, "\n", 1, cur);
+}
+
+int 
+iop_parsex_crlf(const char * buf, uint32_t len, struct iopcur * cur) {
+    return iop_parsex_delim(buf, len, "\r\n", 2, cur);
+}
+
+int 
+iop_parsex_nul(const char * buf, uint32_t len, struct iopcur * cur) {
+    return iop_parsex_delim(buf, len, "", 1, cur);
+}
+
+int 
+iop_parsex_head(const char * buf, uint32_t len, struct iopcur * cur) {
+    return iop_parsex_delim(buf, len, "\r\n\r\n", 4, cur);
+}
+
+// iop_parse_frame - 前缀 head 字节, body n 字节, 没到齐时记下整帧长度
+inline static int iop_parse_frame(uint32_t len, uint32_t head, uint32_t n, struct iopcur * cur) {
+    if (n > INT_RECV - head) {
+        RETURN(EParse, "iop_parse_frame too length = %u", n);
+    }
+    if (len >= head + n)
+        return (int)(head + n);
+    cur->need = head + n;
+    return SBase;
+}
+
+// iop_parse_short - 长度前缀还没到齐
+inline static int iop_parse_short(uint32_t head, struct iopcur * cur) {
+    cur->need = head;
+    return SBase;
+}
+
+int 
+iop_parsex_be16(const char * buf, uint32_t len, struct iopcur * cur) {
+    const uint8_t * s = (const uint8_t *)buf;
+    if (len < 2) return iop_parse_short(2, cur);
+    return iop_parse_frame(len, 2, (uint32_t)s[0] << 8 | s[1], cur);
+}
+
+int 
+iop_parsex_be32(const char * buf, uint32_t len, struct iopcur * cur) {
+    const uint8_t * s = (const uint8_t *)buf;
+    if (len < 4) return iop_parse_short(4, cur);
+    return iop_parse_frame(len, 4, 
+        (uint32_t)s[0] << 24 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 8 | s[3], cur);
+}
+
+int 
+iop_parsex_le16(const char * buf, uint32_t len, struct iopcur * cur) {
+    const uint8_t * s = (const uint8_t *)buf;
+    if (len < 2) return iop_parse_short(2, cur);
+    return iop_parse_frame(len, 2, (uint32_t)s[1] << 8 | s[0], cur);
+}
+
+int 
+iop_parsex_le32(const char * buf, uint32_t len, struct iopcur * cur) {
+    const uint8_t * s = (const uint8_t *)buf;
+    if (len < 4) return iop_parse_short(4, cur);
+    return iop_parse_frame(len, 4, 
+        (uint32_t)s[3] << 24 | (uint32_t)s[2] << 16 | (uint32_t)s[1] << 8 | s[0], cur);
+}
+
+int 
+iop_parsex_varint(const char * buf, uint32_t len, struct iopcur * cur) {
+    const uint8_t * s = (const uint8_t *)buf;
+    uint32_t i, n = 0;
+    // 每字节低 7 位, 高位为 1 表示后面还有, uint32_t 最多 5 字节, 第 5 字节只剩 4 位
+    for (i = 0; i < len; ++i) {
+        if (i >= 4 && s[i] > 0x0f) {
+            RETURN(EParse, "iop_parse_varint prefix overflow");
+        }
+        n |= (uint32_t)(s[i] & 0x7f) << (7 * i);
+        if (!(s[i] & 0x80))
+            return iop_parse_frame(len, i + 1, n, cur);
+    }
+    return iop_parse_short(len + 1, cur);
+}
+
+// iop_parse_xxx 不带游标的版本, 每次都从头解析
+int 
+iop_parse_lf(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_lf(buf, len, &cur);
+}
+
+int 
+iop_parse_crlf(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_crlf(buf, len, &cur);
+}
+
+int 
+iop_parse_nul(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_nul(buf, len, &cur);
+}
+
+int 
+iop_parse_head(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_head(buf, len, &cur);
+}
+
+int 
+iop_parse_be16(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_be16(buf, len, &cur);
+}
+
+int 
+iop_parse_be32(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_be32(buf, len, &cur);
+}
+
+int 
+iop_parse_le16(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_le16(buf, len, &cur);
+}
+
+int 
+iop_parse_le32(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_le32(buf, len, &cur);
+}
+
+int 
+iop_parse_varint(const char * buf, uint32_t len) {
+    struct iopcur cur = { 0 };
+    return iop_parsex_varint(buf, len, &cur);
+}
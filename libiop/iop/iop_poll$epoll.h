@@ -53,27 +53,26 @@ static int epolls_dispatch(iopbase_t base, uint32_t timeout) {
         n = epoll_wait(mata->fd, mata->e, sizeof(mata->e)/sizeof(*mata->e), timeout);
     while (n < SBase && errno == EINTR);
 
-    // 得到当前时间
-    time(&base->curt);
+    // 得到当前时间, 本轮回调共用
+    base->curt = mstime();
     for (i = 0; i < n; ++i) {
         struct epoll_event * ev = mata->e + i;
         uint32_t id = ev->data.u32;
-        if (id >= 0 && id < base->maxio) {
-            if (id < base->maxio) {
-                iop_t iop = base->ios + id;
-                int what = to_what(ev->events);
-                iop_callback(base, iop, what);
-            }
+        // 同一批事件中 iop 可能已经被删除甚至复用, 代数对不上直接跳过
+        iop_t iop = iop_find(base, id);
+        if (iop) {
+            int what = to_what(ev->events);
+            iop_callback(base, iop, what);
         }
     }
     return n;
 }
 
-// epoll 添加处理事件
+// epoll 添加处理事件, IOP_F_ET 时所有句柄都走边缘触发
 inline static int epolls_add(iopbase_t base, uint32_t id, socket_t s, uint32_t event) {
     struct epolls * mata = base->mata;
     struct epoll_event e = { .data = { .u32 = id} };
-    e.events = to_event(event);
+    e.events = to_event(event) | (base->flags & IOP_F_ET ? EPOLLET : 0);
     return epoll_ctl(mata->fd, EPOLL_CTL_ADD, s, &e);
 }
 
@@ -88,7 +87,7 @@ inline static int epolls_del(iopbase_t base, uint32_t id, socket_t s) {
 inline static int epolls_mod(iopbase_t base, uint32_t id, socket_t s, uint32_t event) {
     struct epolls * mata = base->mata;
     struct epoll_event e = { .data = { .u32 = id} };
-    e.events = to_event(event);
+    e.events = to_event(event) | (base->flags & IOP_F_ET ? EPOLLET : 0);
     return epoll_ctl(mata->fd, EPOLL_CTL_MOD, s, &e);
 }
 
@@ -100,7 +99,16 @@ inline static int epolls_mod(iopbase_t base, uint32_t id, socket_t s, uint32_t e
 inline int
 iop_poll(iopbase_t base) {
     struct epolls * mata;
-    int fd = epoll_create1(EPOLL_CLOEXEC);
+    int fd;
+
+    // 优先 io_uring, 内核不支持时回退到 epoll
+    if (base->flags & IOP_F_URING) {
+        if (urings_poll(base) >= SBase)
+            return SBase;
+    }
+    base->flags &= ~(IOP_F_URING | IOP_F_UIO);
+
+    fd = epoll_create1(EPOLL_CLOEXEC);
     if (fd < SBase) {
         RETURN(EBase, "epoll_create1 is error");
     }
@@ -47,13 +47,13 @@ static int selecs_dispatch(iopbase_t base, uint32_t timeout) {
     // window select only listen socket 
     n = select(0, &mata->rsot, &mata->wsot, NULL, p);
 #endif
-    time(&base->curt);
+    base->curt = mstime();
     if (n <= 0) return n;
 
     num = 0;
     curid = base->iohead;
     while (curid != SOCKET_ERROR && num < n) {
-        iop = base->ios + curid;
+        iop = iop_get(base, curid);
         nextid = iop->next;
 
         // 构建时间类型
@@ -86,7 +86,7 @@ inline static int selecs_del(iopbase_t base, uint32_t id, socket_t s) {
         int curid = base->iohead;
         mata->maxfd = SOCKET_ERROR;
         while (curid != SOCKET_ERROR) {
-            iop_t iop = base->ios + curid;
+            iop_t iop = iop_get(base, curid);
             // 找出 base->ios 中最大 socket_t fd
             if (mata->maxfd < iop->s) 
                 mata->maxfd = iop->s;
@@ -135,6 +135,8 @@ inline static int selecs_mod(iopbase_t base, uint32_t id, socket_t s, uint32_t e
 //
 inline int
 iop_poll(iopbase_t base) {
+    // select 只有水平触发
+    base->flags &= ~(IOP_F_ET | IOP_F_URING | IOP_F_UIO);
     base->mata = calloc(1, sizeof(struct selecs));
     base->op.ffree = selecs_free;
     base->op.fdispatch = selecs_dispatch;
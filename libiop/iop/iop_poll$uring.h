@@ -0,0 +1,672 @@
+﻿#ifdef __GNUC__
+
+#include "iop_poll.h"
+#ifdef __has_include
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#  endif
+#endif
+
+// 完成模式的多发 recv 要 6.0 的头文件, Ubuntu 20.04, Debian 11, RHEL 8 这类老系统上
+// 整个 io_uring 后端都不编, IOP_F_URING 照常回退到 epoll
+#ifdef IORING_RECV_MULTISHOT
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+//
+// io_uring 轮询模型, 不依赖 liburing 直接走系统调用.
+// 每个 iop 挂一个多发 POLL_ADD, user_data 就是 iop id, 注册修改删除都只是填 sqe,
+// 等 urings_dispatch 时和等待一起通过一次 io_uring_enter 批量提交.
+// 多发 poll 只在状态变化时通知, 语义等同边缘触发, 所以会强制带上 IOP_F_ET.
+//
+// IOP_F_UIO 完成模式下带 EV_RECV 的 iop 不挂 poll, 改挂多发 RECV 从共享缓冲池取内存,
+// 数据拷进按需增长的 ruf 后立即归还; 发送接管整个 suf 队列提交 SENDMSG, 在路上时新数据继续攒在 suf.
+// 在路上的加上 suf 攒的越过 iop 高水位时先取消 recv, 回落到低水位再挂上, 防止对端只写不读撑爆 suf.
+//
+#define URING_CTL       (1ull << 63)    // 注册修改删除自身的完成事件, 直接丢弃
+#define URING_RECV      (1ull << 62)    // 多发 recv 的完成事件, 低 32 位是 iop id
+#define URING_SEND      (1ull << 61)    // sendmsg 的完成事件, 其余位是 struct ursend 地址
+#define URING_MOD       (1ull << 60)    // poll 原地更新的完成事件, 正在触发时会 EALREADY 失败要重试
+
+//
+// ursend - 在路上的一次发送, iop 删除后等完成事件到了再释放
+//
+struct ursend {
+    struct ursend * next;
+    struct ursend ** prev;
+    uint32_t id;                    // 所属 iop id, 完成时校验代数
+    struct iopsq sq;                // 从 suf 接管过来的发送队列
+    struct msghdr msg;              // 提交后内核还要读, 和 iov 一起放在这里
+    struct iovec iov[INT_IOV];
+};
+
+struct urings {
+    int fd;                         // io_uring 文件描述符
+    unsigned submit;                // 已填充未提交的 sqe 数量
+
+    unsigned * shead;               // 提交队列, 内核消费
+    unsigned * stail;
+    unsigned smask;
+    unsigned sentries;
+    struct io_uring_sqe * sqes;
+
+    unsigned * chead;               // 完成队列, 用户消费
+    unsigned * ctail;
+    unsigned cmask;
+    struct io_uring_cqe * cqes;
+
+    void * sq; size_t sqsz;         // mmap 映射区域
+    void * cq; size_t cqsz;
+    size_t sqesz;
+
+    struct io_uring_buf_ring * br;  // 接收缓冲池, IOP_F_UIO 才有
+    char * bufs;                    // INT_URBUF 块 INT_URBUFSZ 大小的内存
+    uint16_t btail;                 // 缓冲池本地 tail
+    struct ursend * sends;          // 在路上的发送
+};
+
+inline static int io_uring_setup(unsigned entries, struct io_uring_params * p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+inline static int io_uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void * arg, size_t sz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, sz);
+}
+
+inline static int io_uring_register(int fd, unsigned opcode, void * arg, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+// urings_event - iop -> poll 事件转换
+inline static uint32_t urings_event(uint32_t what) {
+    uint32_t events = 0;
+    if (what & EV_READ)
+        events |= POLLIN;
+    if (what & EV_WRITE)
+        events |= POLLOUT;
+    return events;
+}
+
+// urings_what - poll -> iop 事件转换, 出错时读写都通知, 让回调自己发现错误
+inline static uint32_t urings_what(int res) {
+    uint32_t what;
+    if (res < 0 || (res & (POLLHUP | POLLERR)))
+        what = EV_READ | EV_WRITE;
+    else {
+        what = 0;
+        if (res & POLLIN)
+            what |= EV_READ;
+        if (res & POLLOUT)
+            what |= EV_WRITE;
+    }
+    return what;
+}
+
+// urings_submit - 提交已填充的 sqe, wait > 0 时顺带等待完成事件
+static int urings_submit(struct urings * mata, unsigned wait, uint32_t timeout) {
+    int n;
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = { .ts = (uint64_t)(uintptr_t)&ts };
+    void * parg = NULL;
+    size_t sz = 0;
+
+    if (wait) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000ll;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        parg = &arg;
+        sz = sizeof arg;
+    }
+
+    do
+        n = io_uring_enter(mata->fd, mata->submit, wait, flags, parg, sz);
+    while (n < SBase && errno == EINTR);
+    if (n >= SBase)
+        mata->submit -= (unsigned)n;
+    return n;
+}
+
+// urings_free - io_uring 句柄释放, 关闭 ring 会取消所有 poll, recv 和 sendmsg.
+// 映射区也持有 ring 的引用, 全部解除后内核才会撤销请求, 之后才能释放它们用到的内存
+inline static void urings_free(iopbase_t base) {
+    struct urings * mata = base->mata;
+    if (mata) {
+        base->mata = NULL;
+        if (mata->sqes)
+            munmap(mata->sqes, mata->sqesz);
+        if (mata->cq && mata->cq != mata->sq)
+            munmap(mata->cq, mata->cqsz);
+        if (mata->sq)
+            munmap(mata->sq, mata->sqsz);
+        if (mata->fd >= 0)
+            close(mata->fd);
+
+        while (mata->sends) {
+            struct ursend * m = mata->sends;
+            mata->sends = m->next;
+            iopsq_clear(&m->sq);
+            free(m);
+        }
+        if (mata->br)
+            munmap(mata->br, INT_URBUF * sizeof(struct io_uring_buf));
+        free(mata->bufs);
+        free(mata);
+    }
+}
+
+// urings_sqe - 取一个空闲 sqe, 提交队列满了先提交一次腾出位置
+static struct io_uring_sqe * urings_sqe(struct urings * mata) {
+    struct io_uring_sqe * sqe;
+    unsigned tail = *mata->stail;
+    if (tail - __atomic_load_n(mata->shead, __ATOMIC_ACQUIRE) >= mata->sentries) {
+        if (urings_submit(mata, 0, 0) < SBase) {
+            RETNUL("io_uring_enter submit error fd = %d", mata->fd);
+        }
+    }
+
+    sqe = mata->sqes + (tail & mata->smask);
+    memset(sqe, 0, sizeof *sqe);
+    // sq array 初始化时已经按下标一一对应, 这里只推进 tail
+    __atomic_store_n(mata->stail, tail + 1, __ATOMIC_RELEASE);
+    ++mata->submit;
+    return sqe;
+}
+
+// urings_arm - 挂上多发 poll
+static int urings_arm(struct urings * mata, uint32_t id, socket_t s, uint32_t event) {
+    struct io_uring_sqe * sqe = urings_sqe(mata);
+    if (NULL == sqe)
+        return EBase;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = s;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = urings_event(event);
+    sqe->user_data = id;
+    return SBase;
+}
+
+// urings_update - 原地更新多发 poll 关注的事件
+static int urings_update(struct urings * mata, uint32_t id, uint32_t event) {
+    struct io_uring_sqe * sqe = urings_sqe(mata);
+    if (NULL == sqe)
+        return EBase;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+    sqe->addr = id;
+    sqe->poll32_events = urings_event(event);
+    sqe->user_data = URING_MOD | id;
+    return SBase;
+}
+
+// urings_recycle - 归还一块接收缓冲给内核
+inline static void urings_recycle(struct urings * mata, uint16_t bid) {
+    struct io_uring_buf * b = mata->br->bufs + (mata->btail & (INT_URBUF - 1));
+    b->addr = (uintptr_t)(mata->bufs + (size_t)bid * INT_URBUFSZ);
+    b->len = INT_URBUFSZ;
+    b->bid = bid;
+    __atomic_store_n(&mata->br->tail, ++mata->btail, __ATOMIC_RELEASE);
+}
+
+// urings_cancel - 按 user_data 取消挂着的请求
+static int urings_cancel(struct urings * mata, uint64_t data) {
+    struct io_uring_sqe * sqe = urings_sqe(mata);
+    if (NULL == sqe)
+        return EBase;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = URING_CTL | (uint32_t)data;
+    return SBase;
+}
+
+// urings_recv - 挂上多发 recv, 内存从缓冲池 0 组中选
+static int urings_recv(struct urings * mata, iop_t iop) {
+    struct io_uring_sqe * sqe = urings_sqe(mata);
+    if (NULL == sqe)
+        return EBase;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = iop->s;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_RECV | iop->id;
+    return SBase;
+}
+
+// urings_recvd - 多发 recv 完成, 数据拷进 ruf 后交给 iop_recv 取走
+static void urings_recvd(iopbase_t base, struct urings * mata, uint32_t id, int res, uint32_t flags) {
+    iop_t iop = iop_find(base, id);
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (iop && res > 0) {
+            // 每次完成都回调过解析, ruf 还剩满 INT_RECV 说明永远凑不出一个包, 再收只会无限增长.
+            // 积压在就绪链表或者暂停读时解析方会回来处理, 暂停后路上的完成有缓冲池兜底
+            if (tbuf_len(iop->ruf) >= INT_RECV && !iop->ready && !iop->rpause && !iop->rstop)
+                res = -EMSGSIZE;
+            else
+                tbuf_appendn(iop->ruf, mata->bufs + (size_t)bid * INT_URBUFSZ, res);
+        }
+        urings_recycle(mata, bid);
+    }
+    // iop_del 或者 iop_mod 主动取消的
+    if (NULL == iop || res == -ECANCELED)
+        return;
+
+    // 缓冲池暂时用完, 数据还在内核里, 上面已经归还过了, 重新挂上接着收
+    if (res == -ENOBUFS) {
+        if (!(flags & IORING_CQE_F_MORE) && (iop->event & EV_READ) && !iop->rstop)
+            urings_recv(mata, iop);
+        return;
+    }
+
+    if (iop->rn >= SBase)
+        iop->rn = res > 0 ? iop->rn + res : (res == 0 ? EClose : EBase);
+    iop_callback(base, iop, EV_READ);
+    if (res <= 0 || NULL == (iop = iop_find(base, id)) || !(iop->event & EV_READ) || iop->rstop)
+        return;
+
+    // 发送积压先停止接收, 回落到低水位时再挂上
+    if (iop->sending && iop->suf->len + iop->sflight > iop->whigh) {
+        iop->rstop = true;
+        if (flags & IORING_CQE_F_MORE)
+            urings_cancel(mata, URING_RECV | id);
+        return;
+    }
+
+    // 多发 recv 被内核终止, iop 还活着并且还在读就重新挂上
+    if (!(flags & IORING_CQE_F_MORE))
+        urings_recv(mata, iop);
+}
+
+// urings_sendto - 提交 m 还没发完的部分, 一次最多 INT_IOV 段
+static int urings_sendto(struct urings * mata, socket_t s, struct ursend * m) {
+    struct io_uring_sqe * sqe = urings_sqe(mata);
+    if (NULL == sqe)
+        return EBase;
+    m->msg.msg_iov = m->iov;
+    m->msg.msg_iovlen = iopsq_iov(&m->sq, m->iov, INT_IOV);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s;
+    sqe->addr = (uintptr_t)&m->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_SEND | (uintptr_t)m;
+    return SBase;
+}
+
+// urings_send - 完成模式发送, 没有在路上的发送时接管 suf 提交
+static int urings_send(iopbase_t base, iop_t iop) {
+    struct ursend * m;
+    struct urings * mata = base->mata;
+    if (iop->sending || iop->suf->len <= 0)
+        return SBase;
+
+    m = calloc(1, sizeof(struct ursend));
+    if (NULL == m) {
+        RETURN(EAlloc, "calloc ursend error id = %u", iop->id);
+    }
+    m->id = iop->id;
+    m->sq = *iop->suf;
+    if (urings_sendto(mata, iop->s, m) < SBase) {
+        free(m);
+        return EBase;
+    }
+
+    // 在路上的段地址不能再变, suf 重新从空开始攒
+    iop->sflight = m->sq.len;
+    memset(iop->suf, 0, sizeof(struct iopsq));
+    iop->sending = m;
+    if ((m->next = mata->sends))
+        mata->sends->prev = &m->next;
+    m->prev = &mata->sends;
+    mata->sends = m;
+    return SBase;
+}
+
+// urings_wlow - 发送有进展, 回落到低水位时先恢复接收, 再回调 EV_WLOW
+// 放在回调之前, 回调里恢复 EV_READ 不会重复挂 recv
+static int urings_wlow(iopbase_t base, iop_t iop) {
+    if (iop->rstop && iop->suf->len + iop->sflight <= iop->wlow) {
+        iop->rstop = false;
+        if (iop->event & EV_READ)
+            urings_recv(base->mata, iop);
+    }
+    return iop_wlow(base, iop);
+}
+
+// urings_sent - send 完成, 没发完接着发, 发完了看 suf 里有没有新攒的
+static void urings_sent(iopbase_t base, struct urings * mata, struct ursend * m, int res) {
+    iop_t iop = iop_find(base, m->id);
+    if (iop && res >= SBase) {
+        iopsq_pop(&m->sq, res);
+        iop->sflight = m->sq.len;
+        if (m->sq.len > 0) {
+            if (urings_sendto(mata, iop->s, m) >= SBase) {
+                if (urings_wlow(base, iop) < SBase)
+                    base->fdel(base, iop->id);
+                return;
+            }
+            res = EBase;
+        }
+    }
+
+    if ((*m->prev = m->next))
+        m->next->prev = m->prev;
+    iopsq_clear(&m->sq);
+    free(m);
+
+    if (iop) {
+        iop->sending = NULL;
+        if (res < SBase) {
+            CERR("io_uring send error id = %u, res = %d", iop->id, res);
+            base->fdel(base, iop->id);
+            return;
+        }
+
+        iop->sflight = 0;
+        urings_send(base, iop);
+        if (urings_wlow(base, iop) < SBase)
+            base->fdel(base, iop->id);
+    }
+}
+
+// io_uring 事件调度处理, 提交和等待合并成一次系统调用
+static int urings_dispatch(iopbase_t base, uint32_t timeout) {
+    int n = 0;
+    unsigned head, tail;
+    struct urings * mata = base->mata;
+
+    if (urings_submit(mata, 1, timeout) < SBase && errno != ETIME && errno != EBUSY) {
+        CERR("io_uring_enter wait error fd = %d", mata->fd);
+    }
+
+    // 得到当前时间, 本轮回调共用
+    base->curt = mstime();
+    head = *mata->chead;
+    tail = __atomic_load_n(mata->ctail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head, ++n) {
+        iop_t iop;
+        struct io_uring_cqe * cqe = mata->cqes + (head & mata->cmask);
+        uint64_t data = cqe->user_data;
+        uint32_t flags = cqe->flags;
+        int res = cqe->res;
+
+        // 先归还 cqe, 回调中可能继续提交
+        __atomic_store_n(mata->chead, head + 1, __ATOMIC_RELEASE);
+        if (data & URING_CTL)
+            continue;
+        if (data & URING_MOD) {
+            // 更新撞上 poll 正在触发, 按最新的关注事件重新更新, 更新成功时内核会重新检查就绪状态
+            if (res == -EALREADY && (iop = iop_find(base, (uint32_t)data)))
+                urings_update(mata, iop->id, iop->event);
+            continue;
+        }
+        if (data & URING_SEND) {
+            urings_sent(base, mata, (struct ursend *)(uintptr_t)(data & ~URING_SEND), res);
+            continue;
+        }
+        if (data & URING_RECV) {
+            urings_recvd(base, mata, (uint32_t)data, res, flags);
+            continue;
+        }
+
+        // 同一批事件中 iop 可能已经被删除甚至复用, 代数对不上直接跳过
+        iop = iop_find(base, (uint32_t)data);
+        if (NULL == iop)
+            continue;
+        if (res == -ECANCELED && !(flags & IORING_CQE_F_MORE)) {
+            // 多发 poll 被内核终止, 重新挂上, 不通知回调
+            urings_arm(mata, iop->id, iop->s, iop->event);
+            continue;
+        }
+
+        iop_callback(base, iop, urings_what(res));
+
+        // 多发 poll 被内核终止, iop 还活着就重新挂上
+        if (!(flags & IORING_CQE_F_MORE) && (iop = iop_find(base, (uint32_t)data)))
+            urings_arm(mata, iop->id, iop->s, iop->event);
+    }
+    return n;
+}
+
+// io_uring 添加处理事件, EV_RECV 只挂多发 recv
+inline static int urings_add(iopbase_t base, uint32_t id, socket_t s, uint32_t event) {
+    if (event & EV_RECV)
+        return event & EV_READ ? urings_recv(base->mata, iop_get(base, id)) : SBase;
+    return urings_arm(base->mata, id, s, event);
+}
+
+// io_uring 删除监视操作, 按 user_data 找到 poll 或者 recv 移除.
+// 内核请求持有 socket 的引用, 在路上的发送也要取消, 否则 close 后连接还挂在对端不读的窗口上
+inline static int urings_del(iopbase_t base, uint32_t id, socket_t s) {
+    struct io_uring_sqe * sqe;
+    iop_t iop = iop_get(base, id);
+    if (iop->sending && urings_cancel(base->mata, URING_SEND | (uintptr_t)iop->sending) < SBase)
+        return EBase;
+    if (iop->event & EV_RECV)
+        return iop->event & EV_READ ? urings_cancel(base->mata, URING_RECV | id) : SBase;
+
+    sqe = urings_sqe(base->mata);
+    if (NULL == sqe)
+        return EBase;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = id;
+    sqe->user_data = URING_CTL | id;
+    return SBase;
+}
+
+// io_uring 修改句柄注册, 原地更新 poll 关注的事件, EV_RECV 按 EV_READ 挂上或者取消 recv
+inline static int urings_mod(iopbase_t base, uint32_t id, socket_t s, uint32_t event) {
+    iop_t iop = iop_get(base, id);
+    if (iop->event & EV_RECV) {
+        // rstop 时 recv 已经取消, 等发送完成统一挂上, 这里再挂会重复
+        if ((event & EV_READ) && !(iop->event & EV_READ))
+            return iop->rstop ? SBase : urings_recv(base->mata, iop);
+        if (!(event & EV_READ) && (iop->event & EV_READ))
+            return urings_cancel(base->mata, URING_RECV | id);
+        return SBase;
+    }
+    return urings_update(base->mata, id, event);
+}
+
+// urings_map - 映射提交和完成队列
+static int urings_map(struct urings * mata, struct io_uring_params * p) {
+    unsigned i, * array;
+    mata->sqsz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    mata->cqsz = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (mata->cqsz > mata->sqsz)
+            mata->sqsz = mata->cqsz;
+        mata->cqsz = mata->sqsz;
+    }
+
+    mata->sq = mmap(NULL, mata->sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mata->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == mata->sq) {
+        mata->sq = NULL;
+        RETURN(EBase, "mmap sq ring error fd = %d", mata->fd);
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+        mata->cq = mata->sq;
+    else {
+        mata->cq = mmap(NULL, mata->cqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mata->fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == mata->cq) {
+            mata->cq = NULL;
+            RETURN(EBase, "mmap cq ring error fd = %d", mata->fd);
+        }
+    }
+    mata->sqesz = p->sq_entries * sizeof(struct io_uring_sqe);
+    mata->sqes = mmap(NULL, mata->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mata->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == mata->sqes) {
+        mata->sqes = NULL;
+        RETURN(EBase, "mmap sqes error fd = %d", mata->fd);
+    }
+
+    mata->shead = (unsigned *)((char *)mata->sq + p->sq_off.head);
+    mata->stail = (unsigned *)((char *)mata->sq + p->sq_off.tail);
+    mata->smask = *(unsigned *)((char *)mata->sq + p->sq_off.ring_mask);
+    mata->sentries = *(unsigned *)((char *)mata->sq + p->sq_off.ring_entries);
+    array = (unsigned *)((char *)mata->sq + p->sq_off.array);
+    for (i = 0; i < mata->sentries; ++i)
+        array[i] = i;
+
+    mata->chead = (unsigned *)((char *)mata->cq + p->cq_off.head);
+    mata->ctail = (unsigned *)((char *)mata->cq + p->cq_off.tail);
+    mata->cmask = *(unsigned *)((char *)mata->cq + p->cq_off.ring_mask);
+    mata->cqes = (struct io_uring_cqe *)((char *)mata->cq + p->cq_off.cqes);
+    return SBase;
+}
+
+// urings_unpbuf - 释放接收缓冲池, 回退到轮询模式时用, reged 表示已经注册到内核
+static void urings_unpbuf(struct urings * mata, bool reged) {
+    if (reged) {
+        struct io_uring_buf_reg reg = { 0 };
+        io_uring_register(mata->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    if (mata->br) {
+        munmap(mata->br, INT_URBUF * sizeof(struct io_uring_buf));
+        mata->br = NULL;
+    }
+    free(mata->bufs);
+    mata->bufs = NULL;
+}
+
+// urings_pbuf - 注册接收缓冲池, 需要 5.19 以上内核, 多发 recv 需要 6.0
+static int urings_pbuf(struct urings * mata) {
+    uint16_t i;
+    struct io_uring_buf_reg reg = { 0 };
+    void * br = mmap(NULL, INT_URBUF * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, 
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == br) {
+        RETURN(EBase, "mmap buf ring error fd = %d", mata->fd);
+    }
+    mata->br = br;
+    mata->bufs = malloc((size_t)INT_URBUF * INT_URBUFSZ);
+    if (NULL == mata->bufs) {
+        urings_unpbuf(mata, false);
+        RETURN(EAlloc, "malloc bufs error fd = %d", mata->fd);
+    }
+
+    reg.ring_addr = (uintptr_t)br;
+    reg.ring_entries = INT_URBUF;
+    reg.bgid = 0;
+    if (io_uring_register(mata->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < SBase) {
+        urings_unpbuf(mata, false);
+        RETURN(EBase, "io_uring_register pbuf ring error fd = %d", mata->fd);
+    }
+
+    for (i = 0; i < INT_URBUF; ++i)
+        urings_recycle(mata, i);
+    return SBase;
+}
+
+// urings_probe - 在 socketpair 上试挂一次多发 recv, 6.0 以下内核不认 IORING_RECV_MULTISHOT 会直接失败.
+// 先写一字节再关掉对端, 支持时先收到带 F_MORE 的 1 字节, 再收到 0 结束
+static int urings_probe(struct urings * mata) {
+    int sv[2], more = 1, ok = 0;
+    unsigned head, tail;
+    struct io_uring_sqe * sqe;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < SBase) {
+        RETURN(EBase, "socketpair error fd = %d", mata->fd);
+    }
+    if (NULL == (sqe = urings_sqe(mata))) {
+        close(sv[0]);
+        close(sv[1]);
+        return EBase;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_CTL;
+    if (write(sv[1], "", 1) != 1)
+        more = 0;
+    close(sv[1]);
+
+    // 超时还没结束的完成事件是 URING_CTL, 之后 urings_dispatch 会丢弃
+    while (more && urings_submit(mata, 1, INT_DISPATCH) >= SBase) {
+        head = *mata->chead;
+        tail = __atomic_load_n(mata->ctail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe * cqe = mata->cqes + (head & mata->cmask);
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+                urings_recycle(mata, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+            if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE))
+                ok = 1;
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                more = 0;
+        }
+        __atomic_store_n(mata->chead, head, __ATOMIC_RELEASE);
+    }
+    close(sv[0]);
+    if (!ok) {
+        RETURN(EBase, "io_uring multishot recv not support fd = %d", mata->fd);
+    }
+    return SBase;
+}
+
+//
+// urings_poll - 为 iop base 对象注入 io_uring 处理行为
+// base     : 总的 iop 对象基础管理器
+// return   : SBase 表示成功, 内核不支持时返回 EBase, 由调用方回退到 epoll
+//
+static int urings_poll(iopbase_t base) {
+    struct urings * mata;
+    struct io_uring_params p = { 0 };
+    int fd = io_uring_setup(INT_URING, &p);
+    if (fd < SBase) {
+        RETURN(EBase, "io_uring_setup is error");
+    }
+    // 等待要带超时 (5.11), poll 要能多发和原地修改 (5.13), 老内核都不支持
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_RSRC_TAGS)) {
+        close(fd);
+        RETURN(EBase, "io_uring features not support 0x%x", p.features);
+    }
+
+    mata = calloc(1, sizeof(struct urings));
+    mata->fd = fd;
+    base->mata = mata;
+    if (urings_map(mata, &p) < SBase) {
+        urings_free(base);
+        return EBase;
+    }
+
+    // 完成模式注册不了缓冲池或者不支持多发 recv 就只用轮询模式
+    if ((base->flags & IOP_F_UIO) && urings_pbuf(mata) < SBase)
+        base->flags &= ~IOP_F_UIO;
+    if ((base->flags & IOP_F_UIO) && urings_probe(mata) < SBase) {
+        urings_unpbuf(mata, true);
+        base->flags &= ~IOP_F_UIO;
+    }
+    if (base->flags & IOP_F_UIO)
+        base->op.fsend = urings_send;
+
+    base->flags |= IOP_F_ET;
+    base->op.ffree = urings_free;
+    base->op.fdispatch = urings_dispatch;
+    base->op.fadd = urings_add;
+    base->op.fdel = urings_del;
+    base->op.fmod = urings_mod;
+
+    return SBase;
+}
+
+#else
+
+//
+// urings_poll - 编译时没有 io_uring, 直接由调用方回退到 epoll
+// base     : 总的 iop 对象基础管理器
+// return   : EBase
+//
+static int urings_poll(iopbase_t base) {
+    RETURN(EBase, "io_uring not support by kernel headers flags = 0x%x", base->flags);
+}
+
+#endif//IORING_RECV_MULTISHOT
+
+#endif//__GNUC__
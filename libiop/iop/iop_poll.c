@@ -1,2 +1,3 @@
-﻿#include "iop_poll$epoll.h"
+﻿#include "iop_poll$uring.h"
+#include "iop_poll$epoll.h"
 #include "iop_poll$select.h"
@@ -0,0 +1,183 @@
+﻿#include "iop_pool.h"
+
+//
+// ipphost - 一个 host 的空闲连接栈, 后端个数有限, 线性查找
+// 池中所有连接的 iop->srg 都指向所属 ipphost
+//
+struct ipphost {
+    struct ipphost * next;
+    iopp_t p;               // 所属连接池
+    uint32_t n;             // 空闲连接数
+    uint32_t * ids;         // 空闲连接 id, 最后还回的最先取出, maxidle 大小
+    char * host;            // ip:port 串
+};
+
+struct iopp {
+    iopbase_t base;         // 连接所在的 iopbase
+    uint32_t maxidle;       // 每个 host 最多保留的空闲连接数
+    uint32_t idle;          // 空闲连接保留毫秒数
+    uint32_t to;            // 连接和使用中的超时毫秒数
+    struct ipphost * hosts; // 所有 host 链表
+};
+
+// iopp_host - 找到 host 对应的空闲连接栈, 没有就新建
+static struct ipphost * iopp_host(iopp_t p, const char * host) {
+    size_t len;
+    struct ipphost * h;
+    for (h = p->hosts; h; h = h->next)
+        if (!strcmp(h->host, host))
+            return h;
+
+    // ids 和 host 跟在结构后面一次分配
+    len = strlen(host) + 1;
+    h = malloc(sizeof(struct ipphost) + p->maxidle * sizeof(uint32_t) + len);
+    if (NULL == h) {
+        RETNUL("malloc ipphost error host = %s", host);
+    }
+    h->p = p;
+    h->n = 0;
+    h->ids = (uint32_t *)(h + 1);
+    h->host = (char *)(h->ids + p->maxidle);
+    memcpy(h->host, host, len);
+    h->next = p->hosts;
+    p->hosts = h;
+    return h;
+}
+
+// iopp_idle - 空闲连接的事件回调, 可读说明对端关闭或者多发了数据, 和超时一样直接淘汰
+static int iopp_idle(iopbase_t base, uint32_t id, uint32_t events, void * arg) {
+    uint32_t i;
+    struct ipphost * h = arg;
+    if (events & EV_DELETE) {
+        for (i = 0; i < h->n; ++i) {
+            if (h->ids[i] == id) {
+                h->ids[i] = h->ids[--h->n];
+                break;
+            }
+        }
+        return SBase;
+    }
+    return EBase;
+}
+
+//
+// iopp_create - 创建连接池, 连接都挂在 base 上, 要在 iop_delete(base) 之前 iopp_delete
+// base     : io 调度对象
+// maxidle  : 每个 host 最多保留的空闲连接数
+// idle     : 空闲连接保留毫秒数, 超时关闭, '-1' 表示一直保留
+// to       : 连接和取出后使用中的超时毫秒数, '-1' 表示永不超时
+// return   : 失败返回 NULL
+//
+iopp_t 
+iopp_create(iopbase_t base, uint32_t maxidle, uint32_t idle, uint32_t to) {
+    iopp_t p = calloc(1, sizeof(struct iopp));
+    if (NULL == p) {
+        RETNUL("calloc iopp error maxidle = %u", maxidle);
+    }
+    p->base = base;
+    p->maxidle = maxidle;
+    p->idle = idle;
+    p->to = to;
+    return p;
+}
+
+//
+// iopp_delete - 关闭所有空闲连接并释放连接池, 已经取出的连接不受影响
+// p        : iopp_create 返回的对象
+// return   : void
+//
+void 
+iopp_delete(iopp_t p) {
+    struct ipphost * h;
+    if (!p) return;
+    while ((h = p->hosts)) {
+        p->hosts = h->next;
+        // iop_del 回调 iopp_idle 会把 id 从栈中摘掉
+        while (h->n > 0)
+            iop_del(p->base, h->ids[h->n - 1]);
+        free(h);
+    }
+    free(p);
+}
+
+//
+// iopp_get - 取出一个到 host 的连接, 没有空闲的就 iop_connect 新建
+// 有空闲连接时在返回前就回调 EV_CONNECT, 新建的连上后回调 EV_CONNECT, 失败回调 EV_ERROR
+// p        : 连接池
+// host     : ip:port 串
+// fevent   : 使用中的事件回调
+// arg      : 用户参数
+// return   : 成功返回 iop 的 id, 失败返回 EBase
+//
+uint32_t 
+iopp_get(iopp_t p, const char * host, iop_event_f fevent, void * arg) {
+    uint32_t id;
+    iop_t iop;
+    struct ipphost * h = iopp_host(p, host);
+    if (NULL == h)
+        return EBase;
+
+    if (h->n > 0) {
+        id = h->ids[--h->n];
+        iop = iop_get(p->base, id);
+        iop->fevent = fevent;
+        iop->arg = arg;
+        iop_timeout(p->base, id, p->to);
+        // 回调失败连接已经删掉, 不能再把 id 交出去
+        if (fevent(p->base, id, EV_CONNECT, arg) < SBase) {
+            iop_del(p->base, id);
+            return EBase;
+        }
+        return id;
+    }
+
+    id = iop_connect(p->base, host, p->to, fevent, arg);
+    if (EBase == (int)id) {
+        RETURN(EBase, "iop_connect error host = %s", host);
+    }
+    iop_get(p->base, id)->srg = h;
+    return id;
+}
+
+// iopp_owner - 按 iop->srg 在池中找所属 host, 只比较地址不解引用, 不是池中连接返回 NULL
+static struct ipphost * iopp_owner(iopp_t p, iop_t iop) {
+    struct ipphost * h;
+    for (h = p->hosts; h; h = h->next)
+        if (h == iop->srg)
+            return h;
+    return NULL;
+}
+
+//
+// iopp_put - 用完的连接还回连接池, 还有未发完或者未处理的数据, 或者空闲数已满时直接关闭
+// 还回后 fevent 不再收到任何事件, 包括 EV_DELETE, arg 可以直接释放
+// p        : 连接池
+// id       : iopp_get 得到的 iop id
+// return   : >= SBase 成功, 连接直接关闭时也返回 SBase, id 不是池中连接返回 EParam
+//
+int 
+iopp_put(iopp_t p, uint32_t id) {
+    struct ipphost * h;
+    iop_t iop = iop_find(p->base, id);
+    // 已经在空闲栈中的再还一次也按无效处理
+    if (NULL == iop || NULL == (h = iopp_owner(p, iop)) || iop->fevent == iopp_idle) {
+        RETURN(EParam, "iopp_put id is invalid = %u", id);
+    }
+
+    // 先换成空闲回调, 之后关闭也不会再通知用户
+    iop->fevent = iopp_idle;
+    iop->arg = h;
+
+    // 健康检查, 有残留数据或者 socket 出过错的不能给下一个请求用. 完成模式下交给内核的发送也算残留
+    if (h->n >= p->maxidle || iop->suf->len > 0 || iop->sending || tbuf_len(iop_rbuf(p->base, iop)) > 0 
+     || iop->rpause > 0 || socket_get_error(iop->s) != 0)
+        return iop_del(p->base, id);
+
+    // 空闲时只关注可读, 对端关闭能及时发现
+    if (iop->event != EV_READ && iop_mod(p->base, id, EV_READ) < SBase)
+        return iop_del(p->base, id);
+
+    iop_timeout(p->base, id, p->idle);
+    h->ids[h->n++] = id;
+    return SBase;
+}
@@ -0,0 +1,359 @@
+﻿#include "iop_rpc.h"
+
+#define IOPR_REQS       (64)        // 请求表初始容量, 要是 2 的幂
+
+// ioprreq - 一个在路上的请求, timer 挂在 base->wheel 上按 iopbase 时钟超时
+struct ioprreq {
+    struct tnode timer;     // 要放在第一个, 到期回调中直接转回 ioprreq
+    iopr_t r;               // 所属客户端
+    uint32_t id;            // 请求 id
+    iopr_f fcall;           // 结果回调
+    void * arg;             // 用户参数
+};
+
+struct iopr {
+    iopbase_t base;         // 连接所在的 iopbase
+    uint32_t to;            // 连接超时和默认请求超时毫秒数
+    uint32_t iid;           // 连接的 iop id, EBase 表示还没有连接
+    bool ready;             // 连接已经建立, 之前的请求只进 suf
+    bool closing;           // 正在失败所有请求, 回调中再发起请求直接返回 EBase
+    bool dead;              // 回调中 iopr_delete 了, 等最外层回调返回再释放
+    uint32_t ncall;         // 正在执行的结果回调层数
+    uint32_t seq;           // 上一个分配的请求 id
+    uint32_t n;             // 在路上的请求数
+    uint32_t mask;          // 请求表容量减一
+    struct ioprreq ** reqs; // 开放寻址线性探测表, 请求 id 递增, 直接取低位就很均匀
+    char host[];            // ip:port 串
+};
+
+// iopr_grow - 请求表扩容一倍, 所有请求重新探测插入
+static int iopr_grow(iopr_t r) {
+    uint32_t i, j, mask = (r->mask << 1) | 1;
+    struct ioprreq ** reqs = calloc(mask + 1, sizeof(struct ioprreq *));
+    if (NULL == reqs) {
+        RETURN(EAlloc, "calloc ioprreq error cap = %u", mask + 1);
+    }
+    for (i = 0; i <= r->mask; ++i) {
+        if (r->reqs[i]) {
+            for (j = r->reqs[i]->id & mask; reqs[j]; j = (j + 1) & mask)
+                ;
+            reqs[j] = r->reqs[i];
+        }
+    }
+    free(r->reqs);
+    r->reqs = reqs;
+    r->mask = mask;
+    return SBase;
+}
+
+// iopr_put - 请求插入请求表, 负载超过一半先扩容
+static int iopr_put(iopr_t r, struct ioprreq * q) {
+    uint32_t i;
+    if ((r->n + 1) * 2 > r->mask + 1 && iopr_grow(r) < SBase)
+        return EAlloc;
+    for (i = q->id & r->mask; r->reqs[i]; i = (i + 1) & r->mask)
+        ;
+    r->reqs[i] = q;
+    ++r->n;
+    return SBase;
+}
+
+// iopr_take - 按 id 从请求表摘下请求并停掉超时, 没有返回 NULL
+// 删除时把同一条探测链上后面的请求往前挪, 不留墓碑
+static struct ioprreq * iopr_take(iopr_t r, uint32_t id) {
+    uint32_t i, j, k;
+    struct ioprreq * q;
+    for (i = id & r->mask; (q = r->reqs[i]) && q->id != id; i = (i + 1) & r->mask)
+        ;
+    if (NULL == q)
+        return NULL;
+
+    for (j = i; r->reqs[j = (j + 1) & r->mask]; ) {
+        // 理想位置 k 落在 (i, j] 循环区间内的不能挪到 i
+        k = r->reqs[j]->id & r->mask;
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        r->reqs[i] = r->reqs[j];
+        i = j;
+    }
+    r->reqs[i] = NULL;
+    --r->n;
+
+    twheel_del(&r->base->wheel, &q->timer);
+    return q;
+}
+
+// iopr_fcall - 回调请求结果并释放请求, 返回 false 表示回调中 iopr_delete 了, 之后不能再碰 r
+static bool iopr_fcall(iopr_t r, struct ioprreq * q, int code, const char * data, uint32_t len) {
+    ++r->ncall;
+    q->fcall(r, code, data, len, q->arg);
+    free(q);
+    if (--r->ncall == 0 && r->dead) {
+        free(r->reqs);
+        free(r);
+        return false;
+    }
+    return !r->dead;
+}
+
+// iopr_expire - 请求超时, 只失败这一个请求, 连接保留, 迟到的响应按 id 找不到直接丢弃
+static void iopr_expire(struct tnode * node, void * arg) {
+    struct ioprreq * q = (struct ioprreq *)node;
+    iopr_take(q->r, q->id);
+    iopr_fcall(q->r, q, ETout, NULL, 0);
+}
+
+// iopr_fail - 所有在路上的请求回调 code, 回调中发起的请求直接失败
+static void iopr_fail(iopr_t r, int code) {
+    uint32_t i;
+    struct ioprreq * q;
+    bool closing = r->closing;
+    r->closing = true;
+    for (i = 0; i <= r->mask; ++i) {
+        if ((q = r->reqs[i])) {
+            r->reqs[i] = NULL;
+            --r->n;
+            twheel_del(&r->base->wheel, &q->timer);
+            if (!iopr_fcall(r, q, code, NULL, 0))
+                return;
+        }
+    }
+    r->closing = closing;
+}
+
+// iopr_parse - 解析接收缓冲区中完整的响应帧, 按 id 回调对应请求
+// 回调中连接被删除或者 iopr_delete 时 ruf 已经清空或者 r 已经释放, 返回 > SBase 让调用方直接返回
+static int iopr_parse(iopr_t r, iop_t iop) {
+    uint32_t len, id, iid = iop->id;
+    size_t off = 0;
+    struct ioprreq * q;
+    tbuf_t buf = iop_rbuf(r->base, iop);
+    const char * s = tbuf_str(buf);
+
+    while (tbuf_len(buf) - off >= IOPR_HEAD) {
+        memcpy(&len, s + off, sizeof len);
+        memcpy(&id, s + off + 4, sizeof id);
+        len = ntohl(len);
+        id = ntohl(id);
+        // 接收缓冲区最多 INT_RECV, 放不下的帧永远收不完
+        if (len > INT_RECV - IOPR_HEAD) {
+            RETURN(EParse, "iopr_parse len = %u error host = %s", len, r->host);
+        }
+        if (tbuf_len(buf) - off - IOPR_HEAD < len)
+            break;
+
+        if ((q = iopr_take(r, id))) {
+            // 连接删掉后位置可能马上被重连复用, 要和进来时的 id 比
+            if (!iopr_fcall(r, q, SBase, s + off + IOPR_HEAD, len) || r->iid != iid)
+                return SBase + 1;
+        }
+        off += IOPR_HEAD + len;
+    }
+
+    iop_rpop(r->base, iop, off);
+    return SBase;
+}
+
+// iopr_write - 发送 suf 中积压的数据, 发不完关注 EV_WRITE, 水平触发发完就关闭
+static int iopr_write(iopr_t r, iop_t iop) {
+    int n;
+    while (iop->suf->len > 0) {
+        n = iop_sendv(iop);
+        if (n < SBase) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                return EBase;
+            break;
+        }
+        if (n == SBase)
+            break;
+    }
+
+    if ((n = iop_wlow(r->base, iop)) < SBase)
+        return n;
+
+    if (iop->suf->len > 0) {
+        if (!(iop->event & EV_WRITE))
+            return iop_mod(r->base, iop->id, iop->event | EV_WRITE);
+    } else if ((iop->event & EV_WRITE) && !(r->base->flags & IOP_F_ET))
+        return iop_mod(r->base, iop->id, iop->event & ~EV_WRITE);
+    return SBase;
+}
+
+// iopr_event - 连接的事件回调
+static int iopr_event(iopbase_t base, uint32_t id, uint32_t events, void * arg) {
+    int n, c;
+    iopr_t r = arg;
+    iop_t iop = iop_get(base, id);
+
+    // 连接没了, 下一次 iopr_call 重连
+    if (events & EV_DELETE) {
+        r->iid = EBase;
+        r->ready = false;
+        iopr_fail(r, EClose);
+        return SBase;
+    }
+
+    // 连接失败, 随后的 EV_DELETE 统一失败所有请求
+    if (events & EV_ERROR)
+        return SBase;
+
+    // 连上后连接不再超时, 超时只按请求算
+    if (events & EV_CONNECT) {
+        r->ready = true;
+        if ((n = iop_timeout(base, id, -1)) < SBase)
+            return n;
+        return iopr_write(r, iop);
+    }
+
+    if (events & EV_READ) {
+        do {
+            n = iop_recv(base, id);
+            if (n == EClose)
+                return EBase;
+            // iop_recv 出错时已经 iop_del
+            if (n < SBase)
+                return SBase;
+            // 回调中连接或者客户端已经没了, 不能再碰, 也不能再让 iop_callback 删除
+            if (n > SBase && (c = iopr_parse(r, iop)) != SBase)
+                return c < SBase ? EBase : SBase;
+        } while (n > SBase && (base->flags & IOP_F_ET));
+    }
+
+    if (events & EV_WRITE)
+        return iopr_write(r, iop);
+
+    return SBase;
+}
+
+//
+// iopr_create - 创建 rpc 客户端, 第一次 iopr_call 时才建立连接, 断开后下一次调用自动重连
+// base     : io 调度对象
+// host     : ip:port 串
+// to       : 连接超时毫秒数, 也是 iopr_call 传 0 时的默认请求超时
+// return   : 失败返回 NULL
+//
+iopr_t 
+iopr_create(iopbase_t base, const char * host, uint32_t to) {
+    size_t len = strlen(host) + 1;
+    iopr_t r = malloc(sizeof(struct iopr) + len);
+    if (NULL == r) {
+        RETNUL("malloc iopr error host = %s", host);
+    }
+    r->reqs = calloc(IOPR_REQS, sizeof(struct ioprreq *));
+    if (NULL == r->reqs) {
+        free(r);
+        RETNUL("calloc ioprreq error host = %s", host);
+    }
+    r->base = base;
+    r->to = to;
+    r->iid = EBase;
+    r->ready = false;
+    r->closing = false;
+    r->dead = false;
+    r->ncall = 0;
+    r->seq = 0;
+    r->n = 0;
+    r->mask = IOPR_REQS - 1;
+    memcpy(r->host, host, len);
+    return r;
+}
+
+//
+// iopr_delete - 关闭连接并销毁客户端, 还没有结果的请求回调 EClose
+// r        : iopr_create 返回的对象
+// return   : void
+//
+void 
+iopr_delete(iopr_t r) {
+    if (!r || r->dead) return;
+    // iop_del 回调 EV_DELETE 失败所有请求
+    r->closing = true;
+    if (EBase != (int)r->iid)
+        iop_del(r->base, r->iid);
+    iopr_fail(r, EClose);
+
+    // 结果回调中删除的, 等最外层回调返回再释放
+    if (r->ncall > 0) {
+        r->dead = true;
+        return;
+    }
+    free(r->reqs);
+    free(r);
+}
+
+// iopr_send - 请求帧发给连接, 连上之前只进 suf, 小请求拼成一块只走一次 iop_send
+static int iopr_send(iopr_t r, uint32_t id, const void * data, uint32_t len) {
+    int n;
+    char buf[INT_SEG];
+    uint32_t head[2] = { htonl(len), htonl(id) };
+
+    if (!r->ready) {
+        // 只进了帧头时流已经错位, 调用方会删掉连接
+        iop_t iop = iop_get(r->base, r->iid);
+        if (iopsq_push(iop->suf, head, IOPR_HEAD) < SBase)
+            return EAlloc;
+        return iopsq_push(iop->suf, data, len);
+    }
+
+    if (len <= INT_SEG - IOPR_HEAD) {
+        memcpy(buf, head, IOPR_HEAD);
+        memcpy(buf + IOPR_HEAD, data, len);
+        return iop_send(r->base, r->iid, buf, IOPR_HEAD + len);
+    }
+    if ((n = iop_send(r->base, r->iid, head, IOPR_HEAD)) < SBase)
+        return n;
+    return iop_send(r->base, r->iid, data, len);
+}
+
+//
+// iopr_call - 发起一次请求, 不等响应, 同一连接上可以同时有很多请求在路上
+// r        : rpc 客户端
+// data     : 请求 body
+// len      : 请求 body 长度
+// to       : 请求超时毫秒数, 按 iopbase 时钟计时, 0 表示用 iopr_create 的 to
+// fcall    : 结果回调, 只回调一次
+// arg      : 用户参数
+// return   : 成功返回请求 id, 失败返回 EBase 并且不会回调
+//
+uint32_t 
+iopr_call(iopr_t r, const void * data, uint32_t len, uint32_t to, iopr_f fcall, void * arg) {
+    struct ioprreq * q;
+    if (r->closing) {
+        RETURN(EBase, "iopr_call closing host = %s", r->host);
+    }
+    if (EBase == (int)r->iid) {
+        r->iid = iop_connect(r->base, r->host, r->to, iopr_event, r);
+        if (EBase == (int)r->iid) {
+            RETURN(EBase, "iop_connect error host = %s", r->host);
+        }
+    }
+
+    q = malloc(sizeof(struct ioprreq));
+    if (NULL == q) {
+        RETURN(EBase, "malloc ioprreq error host = %s", r->host);
+    }
+    q->r = r;
+    q->fcall = fcall;
+    q->arg = arg;
+    q->timer.fexpire = iopr_expire;
+    // 0 和 EBase 都不做请求 id
+    if (++r->seq == (uint32_t)EBase)
+        r->seq = 1;
+    q->id = r->seq;
+    if (iopr_put(r, q) < SBase) {
+        free(q);
+        return EBase;
+    }
+    twheel_add(&r->base->wheel, &q->timer, r->base->curt + (to ? to : r->to));
+
+    // 发送失败说明连接坏了, 这个请求直接失败, 其它请求随连接删除回调 EClose
+    if (iopr_send(r, q->id, data, len) < SBase) {
+        iopr_take(r, q->id);
+        free(q);
+        iop_del(r->base, r->iid);
+        RETURN(EBase, "iopr_send error host = %s", r->host);
+    }
+    return q->id;
+}
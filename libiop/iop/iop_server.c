@@ -1,85 +1,196 @@
 ﻿#include "iop_server.h"
 
-struct iops {
+// iopt - 调度线程, 每个线程独享一个 iopbase
+struct iopt {
     pthread_t tid;          // 奔跑线程
     iopbase_t base;         // iop 调度总对象
+    struct iops * p;        // 所属 iops 服务
+    uint32_t load;          // 已分发但还没销毁的连接数, 跨线程原子读写
+    uint32_t backoff;       // 监听 accept 出错后的退避毫秒数, 0 表示正常
+};
+
+struct iops {
     uint32_t timeout;       // 超时时间
     volatile bool run;      // true 表示 ios 运行
 
     iop_parse_f fparser;
+    iop_parsex_f fparsex;
+    iop_chunk_f fchunk;
     iop_processor_f fprocessor;
     iop_f fconnect;
     iop_f fdestroy;
     iop_event_f ferror;
+
+    uint32_t balance;       // 新连接分发方式 IOPS_XXX
+    uint32_t budget;        // 每个连接每次唤醒最多处理的包数, 0 表示不限
+    uint32_t naccept;       // 监听每次唤醒最多 accept 的连接数
+    uint32_t next;          // IOPS_ROUND 下一个调度线程
+    uint32_t nwork;         // 调度线程数, 不含 accept 线程
+    uint32_t n;             // 线程总数, 独立 accept 线程放在最后
+    struct iopt ts[];       // 所有线程
 };
 
+//
+// iopsconn - accept 线程投递给调度线程的新连接
+//
+struct iopsconn {
+    struct ioppost post;
+    struct iopt * t;
+    socket_t s;
+};
+
+// iops_parse - 解析并处理接收数据中完整的数据包, 处理完一次性弹出
+// 超过 budget 时剩下的数据留在 ruf, 挂到就绪链表后返回 > SBase
+// 流式 body 收到多少交出去多少, ruf 中只留包头, 多大的 body 都只占一次读的内存
+static int iops_parse(iopbase_t base, uint32_t id, iop_t iop, struct iops * srg, void * arg) {
+    int r, n;
+    uint64_t body;
+    size_t off = 0;
+    uint32_t c = 0;
+    tbuf_t buf = iop_rbuf(base, iop);
+    while (off < tbuf_len(buf)) {
+        if (srg->budget && c++ >= srg->budget) {
+            iop_rpop(base, iop, off);
+            r = iop_ready(base, id);
+            return r < SBase ? r : SBase + 1;
+        }
+
+        // 上一个包的 body 还没收完, 这次到的部分先交出去
+        if (iop->rbody > 0) {
+            body = tbuf_len(buf) - off;
+            if (body > iop->rbody)
+                body = iop->rbody;
+            iop->rbody -= body;
+            r = srg->fchunk(base, id, tbuf_str(buf) + off, (uint32_t)body, iop->rbody, arg);
+            if (r < SBase)
+                return r;
+            off += (size_t)body;
+            continue;
+        }
+
+        // 带游标的解析器说了还差多少, 没到齐就不再调用, 大包只扫描一遍
+        if (srg->fparsex) {
+            if (tbuf_len(buf) - off < iop->cur->need)
+                break;
+            n = srg->fparsex(tbuf_str(buf) + off, (uint32_t)(tbuf_len(buf) - off), iop->cur);
+        } else
+            n = srg->fparser(tbuf_str(buf) + off, (uint32_t)(tbuf_len(buf) - off));
+        if (n < SBase) {
+            r = srg->ferror(base, id, EV_CREATE, arg);
+            if (r < SBase)
+                return r;
+            break;
+        }
+        if (n == SBase)
+            break;
+
+        // 游标只对当前包有效, 下一个包从头算. body 要在 fprocessor 之前记下, 回调中可以看到
+        body = iop->cur->body;
+        memset(iop->cur, 0, sizeof *iop->cur);
+        if (srg->fchunk)
+            iop->rbody = body;
+        r = srg->fprocessor(base, id, tbuf_str(buf) + off, n, arg);
+        if (r < SBase)
+            return r;
+        off += n;
+    }
+    iop_rpop(base, iop, off);
+    return SBase;
+}
+
+// iops_write - 发送 suf 中积压的数据, 每次 writev 聚合多段
+// 水平触发每次可写只发一次, 发完关闭 EV_WRITE; 边缘触发写到 EAGAIN, EV_WRITE 常驻
+static int iops_write(iopbase_t base, uint32_t id, iop_t iop, struct iops * srg, void * arg) {
+    int n;
+    while (iop->suf->len > 0) {
+        n = iop_sendv(iop);
+        if (n < SBase) {
+            // EINTR : 进程还可以处理; EAGIN : 当前缓冲区已经写满, 等下次可写
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                return srg->ferror(base, id, EV_WRITE, arg);
+            break;
+        }
+        if (n == SBase)
+            break;
+
+        if (!(base->flags & IOP_F_ET))
+            break;
+    }
+
+    if ((n = iop_wlow(base, iop)) < SBase)
+        return n;
+
+    if (iop->suf->len <= 0 && (iop->event & EV_WRITE) && !(base->flags & IOP_F_ET))
+        return iop_mod(base, id, iop->event & ~EV_WRITE);
+    return SBase;
+}
+
 static int iops_dispatch(iopbase_t base, uint32_t id, uint32_t events, void * arg) {
     int r, n;
-    iop_t iop = base->ios + id;
-    struct iops * srg = iop->srg;
+    iop_t iop = iop_get(base, id);
+    struct iopt * t = iop->srg;
+    struct iops * srg;
 
-    // 销毁事件
+    // 销毁事件. t 为空是 iop_add 注册失败时的删除, 还没 fconnect, load 由 iops_accept 退还
     if (events & EV_DELETE) {
-        srg->fdestroy(base, id, arg);
+        if (t) {
+            t->p->fdestroy(base, id, arg);
+            ATOM_ADD(&t->load, -1);
+        }
         return SBase;
     }
+    srg = t->p;
 
-    // 读事件
-    if (events & EV_READ) {
-        n = iop_recv(base, id);
-        // 服务器关闭, 直接返回关闭操作
-        if (n == EClose)
-            return EClose;
+    // 发送积压越过高水位先停止读, 对端收走回落到低水位再接着读, 和业务自己的暂停叠加计数
+    if (events & EV_WHIGH)
+        return iop_pause_read(base, id);
+    if (events & EV_WLOW)
+        return iop_resume_read(base, id);
 
-        if (n < SBase) {
-            return srg->ferror(base, id, EV_READ, arg);
-        }
+    // 上一轮预算用完剩下的包先处理, 处理完再按读事件接着读
+    if (events & EV_READY) {
+        r = iops_parse(base, id, iop, srg, arg);
+        if (r != SBase)
+            return r < SBase ? r : SBase;
+        if ((iop->event & EV_RECV) && (r = iop_resume_read(base, id)) < SBase)
+            return r;
+        if (iop->event & EV_READ)
+            events |= EV_READ;
+    }
+
+    // 读事件, 边缘触发要一直读到 EAGAIN. 还有积压在就绪链表上时先不读, 免得 ruf 越攒越多
+    if ((events & EV_READ) && !iop->ready) {
+        do {
+            n = iop_recv(base, id);
+            // 服务器关闭, 直接返回关闭操作
+            if (n == EClose)
+                return EClose;
 
-        for (;;) {
-            // 读取链接关闭
-            n = srg->fparser(iop->ruf->str, iop->ruf->len);
             if (n < SBase) {
-                r = srg->ferror(base, id, EV_CREATE, arg);
-                if (r < SBase)
-                    return r;
-                break;
+                return srg->ferror(base, id, EV_READ, arg);
             }
-            if (n == SBase)
-                break;
 
-            r = srg->fprocessor(base, id, iop->ruf->str, n, arg);
-            if (r >= SBase) {
-                if (n == iop->ruf->len) {
-                    iop->ruf->len = 0;
+            if (n > SBase) {
+                r = iops_parse(base, id, iop, srg, arg);
+                if (r < SBase)
+                    return r;
+                // 预算用完, 剩下的下一轮接着读. 完成模式后端会一直往 ruf 收, 积压期间暂停
+                if (r > SBase) {
+                    if ((iop->event & EV_RECV) && (r = iop_pause_read(base, id)) < SBase)
+                        return r;
                     break;
                 }
-                tstr_popup(iop->ruf, n);
-                continue;
             }
-            return r;
-        }
+        } while (n > SBase && (base->flags & IOP_F_ET) && (iop->event & EV_READ));
     }
 
     // 写事件
     if (events & EV_WRITE) {
-        if (iop->suf->len <= 0)
-            return iop_mod(base, id, events);
-
-        n = socket_send(iop->s, iop->suf->str, iop->suf->len);
-        if (n < SBase) {
-            // EINTR : 进程还可以处理; EAGIN : 当前缓冲区已经写满可以继续写
-            if (errno != EINTR && errno != EAGAIN) {
-                r = srg->ferror(base, id, EV_WRITE, arg);
-                if (r < SBase)
-                    return r;
-            }
-            return SBase;
-        }
-        if (n == SBase)
-            return SBase;
-
-        // 截断已经发送内存
-        tstr_popup(iop->suf, n);
+        r = iops_write(base, id, iop, srg, arg);
+        if (r < SBase)
+            return r;
     }
 
     // 超时时间处理
@@ -92,38 +203,168 @@ static int iops_dispatch(iopbase_t base, uint32_t id, uint32_t events, void * ar
     return SBase;
 }
 
+// iops_accept - 新连接挂到调度线程 t 上, 只能在 t 线程中调用, load 由调用方提前加好
+static void iops_accept(struct iopt * t, socket_t s) {
+    iop_t iop;
+    struct iops * srg = t->p;
+    // 完成模式收发都不用再关心可写; 边缘触发 EV_WRITE 常驻, 省掉 iop_send 和写完时的 iop_mod
+    // socket_accepts 出来的已经是非阻塞
+    uint32_t events = t->base->flags & IOP_F_UIO ? EV_NBLOCK | EV_READ | EV_RECV : 
+                      t->base->flags & IOP_F_ET ? EV_NBLOCK | EV_READ | EV_WRITE : EV_NBLOCK | EV_READ;
+    int r = iop_add(t->base, s, events, srg->timeout, iops_dispatch, NULL);
+    if (r < SBase) {
+        socket_close(s);
+        ATOM_ADD(&t->load, -1);
+        RETNIL("iop_add EV_READ timeout = %d, r = %d", srg->timeout, r);
+    }
+
+    iop = iop_get(t->base, r);
+    iop->srg = t;
+    srg->fconnect(t->base, r, iop->arg);
+}
+
+// iops_post - 调度线程收到 accept 线程投递的新连接
+static void iops_post(iopbase_t base, struct ioppost * post) {
+    struct iopsconn * c = (struct iopsconn *)post;
+    iops_accept(c->t, c->s);
+    free(c);
+}
+
+// iops_handoff - accept 线程按 balance 选出调度线程, 通过无锁队列 + eventfd 投递
+static void iops_handoff(struct iops * p, socket_t s) {
+    uint32_t i;
+    struct iopt * t = p->ts;
+    struct iopsconn * c;
+    if (p->balance == IOPS_LEAST) {
+        for (i = 1; i < p->nwork; ++i)
+            if (ATOM_LOAD(&p->ts[i].load) < ATOM_LOAD(&t->load))
+                t = p->ts + i;
+    } else {
+        t = p->ts + p->next;
+        p->next = (p->next + 1) % p->nwork;
+    }
+
+    c = malloc(sizeof(struct iopsconn));
+    if (NULL == c) {
+        socket_close(s);
+        CERR("malloc iopsconn error s = %d", (int)s);
+        return;
+    }
+    // 投递时就计入负载, 避免突发连接全部挤到同一个线程
+    ATOM_ADD(&t->load, 1);
+    c->post.fpost = iops_post;
+    c->t = t;
+    c->s = s;
+    iop_post(t->base, &c->post);
+}
+
+// iops_backoff - accept 出错时暂停监听, 退避到期由 EV_TIMEOUT 恢复重试.
+// 一直出错时退避时间翻倍, 日志只在开始退避时打一次
+static void iops_backoff(iopbase_t base, uint32_t id, struct iopt * t) {
+    if (0 == t->backoff) {
+        CERR("socket_accepts is error id = %u, backoff", id);
+        t->backoff = 10;
+    } else if ((t->backoff <<= 1) > INT_ACCEPTBK)
+        t->backoff = INT_ACCEPTBK;
+    iop_pause_read(base, id);
+    iop_timeout(base, id, t->backoff);
+}
+
+// iops_listen - 每次唤醒最多 accept naccept 个连接, 剩下的让出给已有连接, 下一轮再接
 static int iops_listen(iopbase_t base, uint32_t id, uint32_t event, void * arg) {
-    if (event & EV_READ) {
-        struct iops * srg = arg;
-        iop_t iop = base->ios + id;
-        socket_t s = socket_accept(iop->s, NULL);
+    struct iopt * t = arg;
+    // 退避中只等 EV_TIMEOUT, 暂停前迟到的可读通知忽略. 到期恢复监听并立即重试, backlog 里的连接不用等新的通知
+    if (t->backoff > 0 && !(event & EV_DELETE)) {
+        if (!(event & EV_TIMEOUT))
+            return SBase;
+        iop_timeout(base, id, -1);
+        iop_resume_read(base, id);
+        event |= EV_READ;
+    }
+    if (event & (EV_READ | EV_READY)) {
+        uint32_t i;
+        for (i = 0; i < t->p->naccept; ++i) {
+            socket_t s = socket_accepts(iop_get(base, id)->s, NULL);
+            // accept 失败不能关闭监听. 对端已经放弃的跳过接着 accept, 
+            // 其它错误 (EMFILE ENFILE ...) 时 backlog 里可能还有连接, 退避一段时间再试
+            if (INVALID_SOCKET == s) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if (errno != EAGAIN) {
+                    iops_backoff(base, id, t);
+                    return SBase;
+                }
+                break;
+            }
+
+            if (t->p->balance == IOPS_REUSEPORT) {
+                ATOM_ADD(&t->load, 1);
+                iops_accept(t, s);
+            } else
+                iops_handoff(t->p, s);
+        }
+        t->backoff = 0;
+        // 边缘触发没有 accept 到 EAGAIN 不会再通知, 挂到就绪链表下一轮接着 accept
+        if (i >= t->p->naccept && (base->flags & IOP_F_ET))
+            iop_ready(base, id);
+    }
+    // io_uring 异步销毁时还持有监听 socket, 先 shutdown 退出监听, 免得新进程的连接被它吃掉再重置
+    if (event & EV_DELETE)
+        shutdown(iop_get(base, id)->s, SHUT_RDWR);
+    return SBase;
+}
+
+static void iops_run(struct iopt * t) {
+    while (t->p->run) {
+        iop_dispatch(t->base);
+    }
+}
+
+// iops_start - 启动一个线程, 独立的 iopbase, host 不为 NULL 时挂上独立的 SO_REUSEPORT 监听
+static int iops_start(struct iops * p, struct iopt * t, const char * host, uint32_t maxio, uint32_t flags) {
+    // 如果创建最终 iopbase_t 对象失败, 直接返回
+    if ((t->base = iop_create_ex(maxio, flags)) == NULL) {
+        RETURN(EAlloc, "iop_create_ex is error maxio = %u", maxio);
+    }
+    t->p = p;
+
+    if (host) {
+        // 构建 socket tcp 服务, 同端口多个监听由内核分流连接
+        socket_t s = socket_tcp(host);
         if (INVALID_SOCKET == s) {
-            RETURN(EFd, "socket_accept is error id = %u", id);
+            RETURN(EFd, "socket_tcp host error is %s", host);
         }
 
-        int r = iop_add(base, s, EV_READ, srg->timeout, iops_dispatch, NULL);
-        if (r < SBase) {
-            socket_close(r);
-            RETURN(r, "iop_add EV_READ timeout = %d, r = %u", srg->timeout, r);
+        // 添加主 iop 对象, 永不超时
+        if (SOCKET_ERROR == iop_add(t->base, s, EV_READ, -1, iops_listen, t)) {
+            socket_close(s);
+            RETURN(EBase, "iop_add is read SOCKET_ERROR error");
         }
+    }
 
-        iop = base->ios + r;
-        iop->srg = srg;
-        srg->fconnect(base, r, iop->arg);
+    // pthread create run func 
+    if (pthread_run(t->tid, iops_run, t)) {
+        RETURN(EBase, "pthread_create error t = %p", t);
     }
+
     return SBase;
 }
 
-static void iops_run(struct iops * p) {
-    while (p->run) {
-        iop_dispatch(p->base);
-    }
+// iops_stop - 停止前 n 个已经启动的调度线程, 并释放所有资源
+static void iops_stop(struct iops * p, uint32_t n) {
+    uint32_t i;
+    p->run = false;
+    for (i = 0; i < n; ++i)
+        pthread_end(p->ts[i].tid);
+    for (i = 0; i < p->n; ++i)
+        iop_delete(p->ts[i].base);
+    free(p);
 }
 
 //
 // iops_create - 创建 iop tcp server 对象并开始监听处理
 // host        : 服务器地址 ip:port
-// timeout     : 超时时间阀值
+// timeout     : 超时毫秒阀值, '-1' 表示永不超时
 // fparser     : 协议解析器
 // fprocessor  : 数据处理器
 // fconnect    : 当连接创建时候回调
@@ -131,7 +372,7 @@ static void iops_run(struct iops * p) {
 // ferror      : 错误的时候回调
 // return      : NULL is error, iops_delete 会采用同步方式结束
 //
-iops_t 
+inline iops_t 
 iops_create(const char * host, 
             uint32_t timeout, 
             iop_parse_f fparser, 
@@ -139,39 +380,68 @@ iops_create(const char * host,
             iop_f fconnect, 
             iop_f fdestroy, 
             iop_event_f ferror) {
-    // 构建 socket tcp 服务
-    socket_t s = socket_tcp(host);
-    if (INVALID_SOCKET == s) {
-        RETNUL("socket_tcp host error is %s", host);
-    }
+    return iops_create_ex(host, NULL, timeout, 
+                          fparser, fprocessor, fconnect, fdestroy, ferror);
+}
 
-    struct iops * p = malloc(sizeof(struct iops));
-    // 如果创建最终 iopbase_t 对象失败, 直接返回
-    if ((p->base = iop_create()) == NULL) {
-        free(p); socket_close(s);
-        RETNUL("iop_create is error");
-    }
+//
+// iops_create_ex - 按扩展配置创建 iop tcp server 对象并开始监听处理
+// host        : 服务器地址 ip:port
+// opt         : 扩展配置, NULL 表示全部默认
+// timeout     : 超时毫秒阀值, '-1' 表示永不超时
+// fparser     : 协议解析器, 所有调度线程共用
+// fprocessor  : 数据处理器, 所有调度线程共用
+// fconnect    : 当连接创建时候回调
+// fdestroy    : 退出时候的回调
+// ferror      : 错误的时候回调
+// return      : NULL is error, iops_delete 会采用同步方式结束
+//
+iops_t 
+iops_create_ex(const char * host, 
+               const struct iopsopt * opt, 
+               uint32_t timeout, 
+               iop_parse_f fparser, 
+               iop_processor_f fprocessor, 
+               iop_f fconnect, 
+               iop_f fdestroy, 
+               iop_event_f ferror) {
+    uint32_t i, n = opt && opt->nthread ? opt->nthread : 1;
+    uint32_t maxio = opt ? opt->maxio : 0;
+    uint32_t balance = opt ? opt->balance : IOPS_REUSEPORT;
+    uint32_t flags = opt ? opt->flags : 0;
+    uint32_t budget = opt ? opt->budget : 0;
+    uint32_t naccept = opt && opt->naccept ? opt->naccept : INT_ACCEPT;
+    struct iops * p;
+#ifdef _MSC_VER
+    // winds 上 SO_REUSEPORT 只是 SO_REUSEADDR, 内核不会分流, 只开一个线程
+    if (balance == IOPS_REUSEPORT)
+        n = 1;
+#endif
 
+    // 独立 accept 线程放在调度线程后面
+    p = calloc(1, sizeof(struct iops) + (n + 1) * sizeof(struct iopt));
     p->run = true;
     p->timeout = timeout;
     p->fparser = fparser;
+    p->fparsex = opt ? opt->fparsex : NULL;
+    p->fchunk = opt ? opt->fchunk : NULL;
     p->fprocessor = fprocessor;
     p->fconnect = fconnect;
     p->fdestroy = fdestroy;
     p->ferror = ferror;
+    p->balance = balance;
+    p->budget = budget;
+    p->naccept = naccept;
+    p->nwork = n;
+    p->n = balance == IOPS_REUSEPORT ? n : n + 1;
 
-    // 添加主 iop 对象, 永不超时
-    if (SOCKET_ERROR == iop_add(p->base, s, EV_READ, -1, iops_listen, p)) {
-        iop_delete(p->base);
-        free(p); socket_close(s);
-        RETNUL("iop_add is read SOCKET_ERROR error");
-    }
-
-    // pthread create run func 
-    if (pthread_run(p->tid, (start_f)iops_run, p)) {
-        iop_delete(p->base);
-        free(p); socket_close(s);
-        RETNUL("pthread_create error r = %p", p);
+    // 每个线程一个 iopbase, 回调函数所有线程共用. 调度线程先于 accept 线程启动
+    for (i = 0; i < p->n; ++i) {
+        const char * listen = balance == IOPS_REUSEPORT || i == n ? host : NULL;
+        if (iops_start(p, p->ts + i, listen, i == n ? 0 : maxio, flags) < SBase) {
+            iops_stop(p, i);
+            RETNUL("iops_start error host = %s, i = %u, n = %u", host, i, n);
+        }
     }
 
     return p;
@@ -184,10 +454,6 @@ iops_create(const char * host,
 //
 inline void 
 iops_delete(iops_t p) {
-    if (p && p->run) {
-        p->run = false;
-        pthread_end(p->tid);
-        iop_delete(p->base);
-        free(p);
-    }
+    if (p && p->run)
+        iops_stop(p, p->n);
 }
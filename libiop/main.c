@@ -90,7 +90,7 @@ static int echo_error(iopbase_t base, uint32_t id, uint32_t events, void * arg)
 //
 void 
 echo_server(void) {
-    iops_t base = iops_create(STR_HOST, INT_TIMEOUT,
+    iops_t base = iops_create(STR_HOST, INT_TIMEOUT * 1000,
         echo_parser, echo_processor, echo_connect, echo_destroy, echo_error);
 
     printf("create a new tcp server host %s\n", STR_HOST);
@@ -0,0 +1,42 @@
+﻿#ifndef _H_ATOM
+#define _H_ATOM
+
+#include "struct.h"
+
+//
+// ATOM_XXX - 多线程间原子操作, 都是全内存屏障
+// ATOM_LOAD    - 原子读 *p
+// ATOM_STORE   - 原子写 *p = v
+// ATOM_XCHG    - 原子交换, 返回 *p 旧值
+// ATOM_ADD     - 原子加, 返回 *p 旧值
+// ATOM_CAS     - *p == o 时写入 v, 成功返回 true
+//
+#ifdef _MSC_VER
+
+#include <intrin.h>
+
+#define ATOM_LOAD(p)            (*(volatile long *)(p))
+#define ATOM_STORE(p, v)        _InterlockedExchange((volatile long *)(p), (long)(v))
+#define ATOM_XCHG(p, v)         _InterlockedExchange((volatile long *)(p), (long)(v))
+#define ATOM_ADD(p, v)          _InterlockedExchangeAdd((volatile long *)(p), (long)(v))
+#define ATOM_CAS(p, o, v)       ((long)(o) == _InterlockedCompareExchange((volatile long *)(p), (long)(v), (long)(o)))
+
+#define ATOM_LOADP(p)           (*(void * volatile *)(p))
+#define ATOM_STOREP(p, v)       _InterlockedExchangePointer((void * volatile *)(p), (v))
+#define ATOM_XCHGP(p, v)        _InterlockedExchangePointer((void * volatile *)(p), (v))
+
+#else
+
+#define ATOM_LOAD(p)            __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define ATOM_STORE(p, v)        __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define ATOM_XCHG(p, v)         __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define ATOM_ADD(p, v)          __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST)
+#define ATOM_CAS(p, o, v)       __sync_bool_compare_and_swap(p, o, v)
+
+#define ATOM_LOADP              ATOM_LOAD
+#define ATOM_STOREP             ATOM_STORE
+#define ATOM_XCHGP              ATOM_XCHG
+
+#endif
+
+#endif//_H_ATOM
@@ -0,0 +1,42 @@
+﻿#ifndef _H_MPSC
+#define _H_MPSC
+
+#include "atom.h"
+
+//
+// mpsc - 无锁多生产者单消费者队列, 侵入式节点, 不负责节点内存
+// 任意线程都可以 mpsc_push, 只能有一个线程 mpsc_pop
+//
+struct mpscnode {
+    struct mpscnode * next;
+};
+
+struct mpsc {
+    struct mpscnode * head;   // 生产者插入端
+    struct mpscnode * tail;   // 消费者弹出端
+    struct mpscnode stub;     // 哨兵节点
+};
+
+//
+// mpsc_init - 初始化队列
+// q        : 队列对象
+// return   : void
+//
+extern void mpsc_init(struct mpsc * q);
+
+//
+// mpsc_push - 插入节点, 多线程安全, wait-free
+// q        : 队列对象
+// node     : 待插入节点
+// return   : void
+//
+extern void mpsc_push(struct mpsc * q, struct mpscnode * node);
+
+//
+// mpsc_pop - 弹出节点, 只能在消费者线程调用
+// q        : 队列对象
+// return   : NULL 表示队列为空, 或者有生产者正插入一半, 稍后再取
+//
+extern struct mpscnode * mpsc_pop(struct mpsc * q);
+
+#endif//_H_MPSC
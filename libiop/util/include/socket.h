@@ -28,6 +28,20 @@ inline void msleep(int ms) {
     usleep(ms * 1000);
 }
 
+//
+// mstime - 单调时钟毫秒数, COARSE 时钟走 vDSO 不会陷入内核
+// return   : 开机以来的毫秒数
+//
+inline uint64_t mstime(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 //
 // This is used instead of -1, since the. by WinSock
 // On now linux EAGAIN and EWOULDBLOCK may be the same value 
@@ -70,6 +84,16 @@ inline int socket_send(socket_t s, const void * buf, int sz) {
     return (int)write(s, buf, sz);
 }
 
+// socket_sendv     - 聚合写入多段数据
+inline int socket_sendv(socket_t s, const struct iovec * iov, int n) {
+    return (int)writev(s, iov, n);
+}
+
+// socket_set_errno - 设置 errno, 回调中用 errno 带出 socket 错误码
+inline void socket_set_errno(int err) {
+    errno = err;
+}
+
 #endif
 
 #ifdef _MSC_VER
@@ -80,6 +104,10 @@ inline void msleep(int ms) {
     Sleep(ms);
 }
 
+inline uint64_t mstime(void) {
+    return GetTickCount64();
+}
+
 #undef  errno
 #define errno                   WSAGetLastError()
 #undef  strerror
@@ -91,6 +119,10 @@ inline void msleep(int ms) {
 #define EAGAIN                  WSAEWOULDBLOCK
 #undef  EINPROGRESS
 #define EINPROGRESS             WSAEWOULDBLOCK
+#undef  ETIMEDOUT
+#define ETIMEDOUT               WSAETIMEDOUT
+#undef  ECONNABORTED
+#define ECONNABORTED            WSAECONNABORTED
 
 /*
  * WinSock 2 extension -- manifest constants for shutdown()
@@ -130,6 +162,11 @@ inline int socket_close(socket_t s) {
     return closesocket(s);
 }
 
+// socket_set_errno - 设置 errno, winds 上 errno 是 WSAGetLastError() 只能这样设置
+inline void socket_set_errno(int err) {
+    WSASetLastError(err);
+}
+
 // socket_set_block     - 设置套接字是阻塞
 // socket_set_nonblock  - 设置套接字是非阻塞
 inline int socket_set_block(socket_t s) {
@@ -152,6 +189,28 @@ inline int socket_send(socket_t s, const void * buf, int sz) {
     return send(s, buf, sz, 0);
 }
 
+//
+// iovec - 和 linux sys/uio.h 一致的分段描述, 发送时转成 WSABUF
+//
+struct iovec {
+    void * iov_base;
+    size_t iov_len;
+};
+
+// socket_sendv     - 聚合写入多段数据, 单次最多 64 段
+inline int socket_sendv(socket_t s, const struct iovec * iov, int n) {
+    int i;
+    DWORD len;
+    WSABUF bufs[64];
+    if (n > (int)(sizeof bufs / sizeof *bufs))
+        n = sizeof bufs / sizeof *bufs;
+    for (i = 0; i < n; ++i) {
+        bufs[i].buf = iov[i].iov_base;
+        bufs[i].len = (ULONG)iov[i].iov_len;
+    }
+    return WSASend(s, bufs, n, &len, 0, NULL, NULL) ? SOCKET_ERROR : (int)len;
+}
+
 #endif
 
 //
@@ -250,6 +309,14 @@ inline int socket_connect(socket_t s, const sockaddr_t addr) {
     return connect(s, (const struct sockaddr *)addr, sizeof(sockaddr_t));
 }
 
+//
+// socket_accepts - accept 出非阻塞并且 exec 时关闭的连接, linux 上 accept4 一次系统调用完成
+// s        : 监听套接字
+// addr     : 返回对端地址, 可以为 NULL
+// return   : INVALID_SOCKET 表示失败, 原因看 errno
+//
+extern socket_t socket_accepts(socket_t s, sockaddr_t addr);
+
 //
 // socket_binds     - 端口绑定返回绑定好的 socket fd, 返回 INVALID_SOCKET or PF_INET PF_INET6
 // socket_listens   - 端口监听返回监听好的 socket fd.
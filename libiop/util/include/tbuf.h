@@ -0,0 +1,73 @@
+﻿#ifndef _H_TBUF
+#define _H_TBUF
+
+#include "struct.h"
+
+//
+// tbuf - 带读游标的缓冲区, [head, tail) 是有效数据
+// 弹出只移动 head, 尾部空间不够时才把剩余数据挪回头部, 流水线上的小包不会反复 memmove
+//
+struct tbuf {
+    size_t head;  // 读游标
+    size_t tail;  // 写游标
+    size_t cap;   // 容量
+    char * str;   // 字符池
+};
+
+typedef struct tbuf * tbuf_t;
+
+//
+// TBUF_CREATE - 栈上创建 tbuf_t 结构
+// TBUF_DELETE - 释放栈上 tbuf_t 结构
+// var  : 变量名
+//
+#define TBUF_CREATE(var)                                    \
+struct tbuf var[1] = { { 0, 0, 0, NULL } }
+
+#define TBUF_DELETE(var)                                    \
+free((var)->str)
+
+//
+// tbuf_len - 得到有效数据长度
+// tbuf_str - 得到有效数据起始位置
+// tbuf_clear - 清空数据, 内存留着复用
+// buf      : 缓冲区
+//
+inline size_t tbuf_len(tbuf_t buf) {
+    return buf->tail - buf->head;
+}
+
+inline char * tbuf_str(tbuf_t buf) {
+    return buf->str + buf->head;
+}
+
+inline void tbuf_clear(tbuf_t buf) {
+    buf->head = buf->tail = 0;
+}
+
+//
+// tbuf_expand - 保证尾部至少还能写 len 字节, 先压缩再扩容
+// buf      : 缓冲区
+// len      : 需要的尾部空间
+// return   : buf->str + buf->tail 位置
+//
+extern char * tbuf_expand(tbuf_t buf, size_t len);
+
+//
+// tbuf_appendn - 尾部追加数据
+// buf      : 缓冲区
+// str      : 待添加的数据
+// sz       : 数据长度
+// return   : void
+//
+extern void tbuf_appendn(tbuf_t buf, const char * str, size_t sz);
+
+//
+// tbuf_popup - 头部弹出 len 长度数据, 只移动读游标, 读空时游标归零
+// buf      : 缓冲区
+// len      : 弹出的长度
+// return   : void
+//
+extern void tbuf_popup(tbuf_t buf, size_t len);
+
+#endif//_H_TBUF
@@ -0,0 +1,85 @@
+﻿#ifndef _H_TWHEEL
+#define _H_TWHEEL
+
+#include "struct.h"
+
+//
+// TWHEEL_XXX 分层时间轮参数, near 轮 1 << 8 格, 其上 4 层每层 1 << 6 格
+// 总共覆盖 1 << 32 个刻度, 更远的到期时间会被截断到最远一层
+//
+#define TWHEEL_NBIT     (8)
+#define TWHEEL_LBIT     (6)
+#define TWHEEL_LEVEL    (4)
+#define TWHEEL_NEAR     (1 << TWHEEL_NBIT)
+#define TWHEEL_SLOT     (1 << TWHEEL_LBIT)
+
+struct tnode;
+
+//
+// tnode_f - 时间轮节点到期回调, 回调前节点已经摘除, 可以在回调中重新挂载
+// node     : 到期的节点
+// arg      : twheel_update 传入的参数
+// return   : void
+//
+typedef void (* tnode_f)(struct tnode * node, void * arg);
+
+//
+// tnode - 时间轮节点, 内嵌到需要定时的对象中
+//
+struct tnode {
+    struct tnode * next;      // 同一格中下一个节点
+    struct tnode ** prev;     // 指向上一个节点 next 域, NULL 表示未挂载
+    uint64_t expire;          // 到期刻度
+    tnode_f fexpire;          // 到期回调
+};
+
+struct twheel {
+    uint64_t tick;            // 下一个待处理刻度
+    uint32_t count;           // 挂载的节点数
+    struct tnode * near[TWHEEL_NEAR];
+    struct tnode * level[TWHEEL_LEVEL][TWHEEL_SLOT];
+};
+
+//
+// twheel_init - 初始化时间轮
+// w        : 时间轮对象
+// now      : 当前刻度
+// return   : void
+//
+extern void twheel_init(struct twheel * w, uint64_t now);
+
+//
+// twheel_add - 挂载节点, 节点必须处于未挂载状态. O(1)
+// w        : 时间轮对象
+// node     : 待挂载节点, fexpire 需要提前设置
+// expire   : 到期刻度, 已过期的节点在下次 twheel_update 时处理
+// return   : void
+//
+extern void twheel_add(struct twheel * w, struct tnode * node, uint64_t expire);
+
+//
+// twheel_del - 摘除节点, 未挂载的节点直接忽略. O(1)
+// w        : 时间轮对象
+// node     : 待摘除节点
+// return   : void
+//
+extern void twheel_del(struct twheel * w, struct tnode * node);
+
+//
+// twheel_update - 推进时间轮到 now, 逐格处理到期节点
+// w        : 时间轮对象
+// now      : 当前刻度
+// arg      : 透传给 fexpire 的参数
+// return   : 本次到期的节点数
+//
+extern int twheel_update(struct twheel * w, uint64_t now, void * arg);
+
+//
+// twheel_wait - 估算距离下一个到期格子的刻度数, 用于限定 io 等待时间
+// w        : 时间轮对象
+// limit    : 最大等待刻度数
+// return   : [0, limit] 之间的刻度数
+//
+extern uint32_t twheel_wait(struct twheel * w, uint32_t limit);
+
+#endif//_H_TWHEEL
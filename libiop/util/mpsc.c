@@ -0,0 +1,64 @@
+﻿#include "mpsc.h"
+
+//
+// mpsc_init - 初始化队列
+// q        : 队列对象
+// return   : void
+//
+inline void 
+mpsc_init(struct mpsc * q) {
+    q->stub.next = NULL;
+    q->head = q->tail = &q->stub;
+}
+
+//
+// mpsc_push - 插入节点, 多线程安全, wait-free
+// q        : 队列对象
+// node     : 待插入节点
+// return   : void
+//
+inline void 
+mpsc_push(struct mpsc * q, struct mpscnode * node) {
+    struct mpscnode * prev;
+    node->next = NULL;
+    // 先抢占 head, 再链接上一个节点, 两步之间消费者会看到断链
+    prev = ATOM_XCHGP(&q->head, node);
+    ATOM_STOREP(&prev->next, node);
+}
+
+//
+// mpsc_pop - 弹出节点, 只能在消费者线程调用
+// q        : 队列对象
+// return   : NULL 表示队列为空, 或者有生产者正插入一半, 稍后再取
+//
+struct mpscnode * 
+mpsc_pop(struct mpsc * q) {
+    struct mpscnode * tail = q->tail;
+    struct mpscnode * next = ATOM_LOADP(&tail->next);
+
+    // 跳过哨兵节点
+    if (tail == &q->stub) {
+        if (NULL == next)
+            return NULL;
+        q->tail = tail = next;
+        next = ATOM_LOADP(&tail->next);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    // tail 不是最后一个节点, 说明有生产者插入到一半
+    if (tail != ATOM_LOADP(&q->head))
+        return NULL;
+
+    // 只剩最后一个节点, 重新插入哨兵后才能弹出
+    mpsc_push(q, &q->stub);
+    next = ATOM_LOADP(&tail->next);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
@@ -1,4 +1,8 @@
-﻿#include "socket.h"
+﻿#ifdef __linux__
+#define _GNU_SOURCE     // accept4
+#endif
+
+#include "socket.h"
 
 #ifdef _MSC_VER
 
@@ -90,6 +94,27 @@ socket_addr(const char * ip, uint16_t port, sockaddr_t addr) {
     return SBase;
 }
 
+//
+// socket_accepts - accept 出非阻塞并且 exec 时关闭的连接, linux 上 accept4 一次系统调用完成
+// s        : 监听套接字
+// addr     : 返回对端地址, 可以为 NULL
+// return   : INVALID_SOCKET 表示失败, 原因看 errno
+//
+socket_t 
+socket_accepts(socket_t s, sockaddr_t addr) {
+#ifdef __linux__
+    socklen_t len = sizeof (sockaddr_t);
+    return accept4(s, (struct sockaddr *)addr, addr ? &len : NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    socket_t c = socket_accept(s, addr);
+    if (INVALID_SOCKET != c && socket_set_nonblock(c) < SBase) {
+        socket_close(c);
+        return INVALID_SOCKET;
+    }
+    return c;
+#endif
+}
+
 //
 // socket_binds     - 端口绑定返回绑定好的 socket fd, 返回 INVALID_SOCKET or PF_INET PF_INET6
 // socket_listens   - 端口监听返回监听好的 socket fd.
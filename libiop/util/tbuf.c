@@ -0,0 +1,61 @@
+﻿#include "tbuf.h"
+
+// INT_TBUF - 缓冲区初始化大小
+#define INT_TBUF  (1<<8)
+
+//
+// tbuf_expand - 保证尾部至少还能写 len 字节, 先压缩再扩容
+// buf      : 缓冲区
+// len      : 需要的尾部空间
+// return   : buf->str + buf->tail 位置
+//
+char * 
+tbuf_expand(tbuf_t buf, size_t len) {
+    size_t cap, n;
+    if (buf->cap - buf->tail >= len)
+        return buf->str + buf->tail;
+
+    // 尾部不够时才把剩余数据挪回头部, 一次搬移抵掉之前所有弹出
+    n = buf->tail - buf->head;
+    if (buf->head > 0) {
+        memmove(buf->str, buf->str + buf->head, n);
+        buf->head = 0;
+        buf->tail = n;
+        if (buf->cap - n >= len)
+            return buf->str + n;
+    }
+
+    // 走 1.5 倍内存分配, 和 tstr 一致
+    cap = buf->cap < INT_TBUF ? INT_TBUF : buf->cap;
+    while (cap < n + len) cap = cap * 3 / 2;
+    buf->str = realloc(buf->str, cap);
+    buf->cap = cap;
+    return buf->str + n;
+}
+
+//
+// tbuf_appendn - 尾部追加数据
+// buf      : 缓冲区
+// str      : 待添加的数据
+// sz       : 数据长度
+// return   : void
+//
+inline void 
+tbuf_appendn(tbuf_t buf, const char * str, size_t sz) {
+    memcpy(tbuf_expand(buf, sz), str, sz);
+    buf->tail += sz;
+}
+
+//
+// tbuf_popup - 头部弹出 len 长度数据, 只移动读游标, 读空时游标归零
+// buf      : 缓冲区
+// len      : 弹出的长度
+// return   : void
+//
+inline void 
+tbuf_popup(tbuf_t buf, size_t len) {
+    if (len >= buf->tail - buf->head)
+        buf->head = buf->tail = 0;
+    else
+        buf->head += len;
+}
@@ -0,0 +1,156 @@
+﻿#include "twheel.h"
+
+// twheel_link - 节点头插到格子链表中
+inline static void twheel_link(struct tnode ** slot, struct tnode * node) {
+    node->next = *slot;
+    if (node->next)
+        node->next->prev = &node->next;
+    node->prev = slot;
+    *slot = node;
+}
+
+// twheel_unlink - 节点从所在链表中摘除
+inline static void twheel_unlink(struct tnode * node) {
+    *node->prev = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+// twheel_slot - 根据到期刻度找到所在格子
+static struct tnode ** twheel_slot(struct twheel * w, uint64_t expire) {
+    int i;
+    uint64_t idx;
+    if (expire < w->tick)
+        expire = w->tick;
+    idx = expire - w->tick;
+    if (idx < TWHEEL_NEAR)
+        return w->near + (expire & (TWHEEL_NEAR - 1));
+
+    // 超出最远一层的截断到最远一层
+    if (idx >= (uint64_t)1 << (TWHEEL_NBIT + TWHEEL_LEVEL * TWHEEL_LBIT))
+        expire = w->tick + ((uint64_t)1 << (TWHEEL_NBIT + TWHEEL_LEVEL * TWHEEL_LBIT)) - 1;
+
+    for (i = 0; i < TWHEEL_LEVEL - 1; ++i)
+        if (idx < (uint64_t)1 << (TWHEEL_NBIT + (i + 1) * TWHEEL_LBIT))
+            break;
+    return w->level[i] + ((expire >> (TWHEEL_NBIT + i * TWHEEL_LBIT)) & (TWHEEL_SLOT - 1));
+}
+
+//
+// twheel_init - 初始化时间轮
+// w        : 时间轮对象
+// now      : 当前刻度
+// return   : void
+//
+inline void 
+twheel_init(struct twheel * w, uint64_t now) {
+    memset(w, 0, sizeof(struct twheel));
+    w->tick = now;
+}
+
+//
+// twheel_add - 挂载节点, 节点必须处于未挂载状态. O(1)
+// w        : 时间轮对象
+// node     : 待挂载节点, fexpire 需要提前设置
+// expire   : 到期刻度, 已过期的节点在下次 twheel_update 时处理
+// return   : void
+//
+inline void 
+twheel_add(struct twheel * w, struct tnode * node, uint64_t expire) {
+    node->expire = expire;
+    twheel_link(twheel_slot(w, expire), node);
+    ++w->count;
+}
+
+//
+// twheel_del - 摘除节点, 未挂载的节点直接忽略. O(1)
+// w        : 时间轮对象
+// node     : 待摘除节点
+// return   : void
+//
+inline void 
+twheel_del(struct twheel * w, struct tnode * node) {
+    if (node->prev) {
+        twheel_unlink(node);
+        --w->count;
+    }
+}
+
+// twheel_cascade - 高层格子中的节点重新分配到低层, 返回格子下标
+static int twheel_cascade(struct twheel * w, int level) {
+    struct tnode * node, * list;
+    int idx = (int)(w->tick >> (TWHEEL_NBIT + level * TWHEEL_LBIT)) & (TWHEEL_SLOT - 1);
+
+    // 先整体摘下来, 再逐个按到期刻度重新挂载
+    list = w->level[level][idx];
+    w->level[level][idx] = NULL;
+    while ((node = list)) {
+        list = node->next;
+        twheel_link(twheel_slot(w, node->expire), node);
+    }
+    return idx;
+}
+
+//
+// twheel_update - 推进时间轮到 now, 逐格处理到期节点
+// w        : 时间轮对象
+// now      : 当前刻度
+// arg      : 透传给 fexpire 的参数
+// return   : 本次到期的节点数
+//
+int 
+twheel_update(struct twheel * w, uint64_t now, void * arg) {
+    int i, n = 0;
+    struct tnode * node, * list;
+    while (w->tick <= now) {
+        // 空轮直接跳到 now
+        if (w->count == 0) {
+            w->tick = now + 1;
+            break;
+        }
+
+        // near 轮转满一圈, 逐层向下拆分
+        if ((w->tick & (TWHEEL_NEAR - 1)) == 0)
+            for (i = 0; i < TWHEEL_LEVEL && twheel_cascade(w, i) == 0; ++i)
+                ;
+
+        // 整格摘到局部链表, 回调中删除其它节点也是安全的
+        list = w->near[w->tick & (TWHEEL_NEAR - 1)];
+        w->near[w->tick & (TWHEEL_NEAR - 1)] = NULL;
+        if (list)
+            list->prev = &list;
+        ++w->tick;
+
+        while ((node = list)) {
+            twheel_unlink(node);
+            --w->count;
+            ++n;
+            node->fexpire(node, arg);
+        }
+    }
+    return n;
+}
+
+//
+// twheel_wait - 估算距离下一个到期格子的刻度数, 用于限定 io 等待时间
+// w        : 时间轮对象
+// limit    : 最大等待刻度数
+// return   : [0, limit] 之间的刻度数
+//
+uint32_t 
+twheel_wait(struct twheel * w, uint32_t limit) {
+    uint32_t i, n;
+    if (w->count == 0)
+        return limit;
+
+    // 只看 near 轮到下一次拆分之前的格子, 高层节点最早也要等到拆分
+    n = TWHEEL_NEAR - (uint32_t)(w->tick & (TWHEEL_NEAR - 1));
+    if (n > limit)
+        n = limit;
+    for (i = 0; i < n; ++i)
+        if (w->near[(w->tick + i) & (TWHEEL_NEAR - 1)])
+            return i;
+    return n;
+}